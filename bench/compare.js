@@ -0,0 +1,47 @@
+// Compare two JSON outputs of bench-scenes, case by case.  Exits with
+// status 1 if any case got more than THRESHOLD percent slower, or did
+// more work.
+//
+//   node bench/compare.js OLD.json NEW.json [THRESHOLD]
+
+'use strict';
+
+const fs = require('fs');
+
+if (process.argv.length < 4 || process.argv.length > 5) {
+  console.error('usage: node compare.js OLD.json NEW.json [THRESHOLD]');
+  process.exit(2);
+}
+let load = file => JSON.parse(fs.readFileSync(file, 'utf8')).cases;
+let key = c => `${c.scene} ${c.resolution}px ${c.threads}t` +
+  (c.antialias ? ' aa' : '') + (c.fixed_point ? ' fixed' : '') +
+  (c.bins ? ` bins${c.bins}` : '') + (c.front_to_back ? ' ftb' : '') +
+  (c.null_backend ? ' null' : '') + (c.repaint ? ' repaint' : '');
+let threshold = Number(process.argv[4] || 10);
+
+let before = new Map(load(process.argv[2]).map(c => [key(c), c]));
+let regressed = false;
+for (let now of load(process.argv[3])) {
+  let was = before.get(key(now));
+  if (!was)
+    continue;
+  let change = (now.best_ms / was.best_ms - 1) * 100;
+  let notes = [];
+  if (change > threshold) {
+    notes.push('SLOWER');
+    regressed = true;
+  }
+  for (let counter of ['painters', 'transforms', 'triangles', 'quads',
+                       'images', 'bounding_box_pixels', 'pixels_tested',
+                       'pixels_written']) {
+    if (now[counter] > was[counter]) {
+      notes.push(`${counter} ${was[counter]} -> ${now[counter]}`);
+      regressed = true;
+    }
+  }
+  console.log(`${key(now).padEnd(28)} ${was.best_ms.toFixed(3).padStart(10)}` +
+              ` -> ${now.best_ms.toFixed(3).padStart(10)} ms` +
+              ` ${(change >= 0 ? '+' : '') + change.toFixed(1)}%` +
+              (notes.length ? '  ' + notes.join(', ') : ''));
+}
+process.exit(regressed ? 1 : 0);
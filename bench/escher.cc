@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <chrono>
+
+#include "../tests/escher.h"
+
+// Milliseconds per call of F, taking the best of ITERATIONS runs.
+template<typename F>
+static double best(int iterations, F f) {
+  double ret = 0;
+  for (int i = 0; i < iterations; i++) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+    if (i == 0 || elapsed.count() < ret)
+      ret = elapsed.count();
+  }
+  return ret;
+}
+
+int main (int argc, char* argv[]) {
+  if (argc > 4) {
+    fprintf(stderr, "usage: %s [RESOLUTION [THREADS [ITERATIONS]]]\n",
+            argv[0]);
+    return 1;
+  }
+  uint32_t resolution = argc > 1 ? atoi(argv[1]) : 1000;
+  uint32_t threads = argc > 2 ? atoi(argv[2]) : 0;
+  int iterations = argc > 3 ? atoi(argv[3]) : 5;
+
+  PainterPtr p = escher();
+  DrawingContext cx(resolution);
+  double serial = best(iterations, [&] { paint(cx, p); });
+  double parallel = best(iterations, [&] { paintParallel(cx, p, threads); });
+
+  printf("escher at %upx, best of %d:\n", resolution, iterations);
+  printf("  paint:         %8.2f ms\n", serial);
+  printf("  paintParallel: %8.2f ms (%u threads, %.2fx)\n", parallel,
+         threads ? threads : parallelism(), serial / parallel);
+  return 0;
+}
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#define HAVE_FORK 1
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "../tests/scenes.h"
+
+struct Options
+{
+  std::vector<uint32_t> resolutions = { 200, 800, 2000 };
+  std::vector<uint32_t> threads = { 1, 0 };
+  int iterations = 5;
+  bool antialias = false;
+  bool fixedPoint = false;
+  // If nonzero, draw into command bins of this tile size, flushed on
+  // the same number of threads as the paint.
+  uint32_t binSize = 0;
+  // If set, compile each scene to a display list and paint that front
+  // to back, on one thread.
+  bool frontToBack = false;
+  // If set, paint into a backend that counts what it is sent instead of
+  // rasterizing it, to time the painters and their geometry alone.
+  bool nullBackend = false;
+  // If set, time moving a small square over each scene with repaint.
+  bool repaint = false;
+  bool json = false;
+  // If set, a directory to write a Chrome trace of each case into.
+  const char *traceDir = nullptr;
+  std::vector<std::string> scenes;
+};
+
+// Run one case, and print its result as a JSON object or a table row.
+static void run(const Scene& scene, uint32_t resolution, uint32_t threads,
+                const Options& options, bool first) {
+  PainterPtr p = scene.make();
+  CountingBackend counts;
+  std::unique_ptr<DrawingContext> context(
+    options.nullBackend ? new DrawingContext(counts, resolution, resolution)
+                        : new DrawingContext(resolution));
+  DrawingContext& cx = *context;
+  cx.setAntialiasing(options.antialias);
+  cx.setFixedPoint(options.fixedPoint);
+  if (threads == 0)
+    threads = parallelism();
+  CommandBins bins(options.binSize);
+  DisplayList list;
+  if (options.frontToBack)
+    list = compile(p);
+  // The scene with the square at one place, as painted, and at another.
+  auto square = [&](double x) {
+    return over(p, transform(red(), Vector(x, 0.45), Vector(x + 0.05, 0.45),
+                             Vector(x, 0.5)));
+  };
+  PainterPtr shown = square(0.3), next = square(0.6);
+  if (options.repaint)
+    paint(cx, shown);
+  auto paintCase = [&] {
+    if (options.frontToBack) {
+      list.paintFrontToBack(cx);
+    } else if (options.repaint) {
+      repaint(cx, shown, next, threads);
+      std::swap(shown, next);
+    } else if (options.binSize) {
+      cx.setBins(&bins);
+      cx.fill(Color::white());
+      p->paint(cx, Frame(Vector(0,0), Vector(1,0), Vector(0,1)));
+      cx.flush(threads);
+      cx.setBins(nullptr);
+    } else {
+      paintParallel(cx, p, threads);
+    }
+  };
+
+  // Warm up, then count and maybe trace the work of a single paint.
+  paintCase();
+  cx.resetStats();
+  counts.reset();
+  RenderTrace trace;
+  if (options.traceDir)
+    cx.setTrace(&trace);
+  paintCase();
+  cx.setTrace(nullptr);
+  RenderStats stats = cx.stats();
+  if (options.nullBackend) {
+    stats.triangles = counts.triangles;
+    stats.quads = counts.quads;
+    stats.images = counts.images;
+  }
+  if (options.traceDir) {
+    std::string fname = std::string(options.traceDir) + "/" + scene.name
+      + "-" + std::to_string(resolution) + "-" + std::to_string(threads)
+      + (options.antialias ? "-aa" : "")
+      + (options.fixedPoint ? "-fixed" : "")
+      + (options.binSize ? "-bins" + std::to_string(options.binSize) : "")
+      + (options.frontToBack ? "-ftb" : "")
+      + (options.nullBackend ? "-null" : "")
+      + (options.repaint ? "-repaint" : "")
+      + ".json";
+    if (!trace.write(fname.c_str()))
+      exit(1);
+  }
+
+  std::vector<double> times;
+  for (int i = 0; i < options.iterations; i++) {
+    auto start = std::chrono::steady_clock::now();
+    paintCase();
+    std::chrono::duration<double, std::milli> elapsed =
+      std::chrono::steady_clock::now() - start;
+    times.push_back(elapsed.count());
+  }
+  std::sort(times.begin(), times.end());
+  double best = times.empty() ? 0 : times.front();
+  double median = times.empty() ? 0 : times[times.size() / 2];
+
+  long peakKB = -1;
+#ifdef HAVE_FORK
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    peakKB = usage.ru_maxrss;
+#endif
+
+  // Fixed point solves for each row's span without testing pixels, so
+  // there is no count to report.
+  std::string tested =
+    options.fixedPoint ? "" : std::to_string(stats.pixelsTested);
+
+  if (options.json) {
+    printf("%s    {\"scene\": \"%s\", \"resolution\": %u, \"threads\": %u,"
+           " \"antialias\": %s, \"fixed_point\": %s, \"bins\": %u,"
+           " \"front_to_back\": %s, \"null_backend\": %s,"
+           " \"repaint\": %s, \"iterations\": %d,"
+           " \"best_ms\": %.3f, \"median_ms\": %.3f,"
+           " \"painters\": %llu, \"transforms\": %llu, \"culled\": %llu,"
+           " \"triangles\": %llu, \"quads\": %llu, \"images\": %llu,"
+           " \"occluded\": %llu,"
+           " \"bounding_box_pixels\": %llu,%s"
+           " \"pixels_covered\": %llu,"
+           " \"pixels_written\": %llu,"
+           " \"bounding_box_efficiency\": %.3f,"
+           " \"peak_rss_kb\": %ld}",
+           first ? "" : ",\n", scene.name, resolution, threads,
+           options.antialias ? "true" : "false",
+           options.fixedPoint ? "true" : "false", options.binSize,
+           options.frontToBack ? "true" : "false",
+           options.nullBackend ? "true" : "false",
+           options.repaint ? "true" : "false", options.iterations,
+           best, median,
+           (unsigned long long)stats.painters,
+           (unsigned long long)stats.transforms,
+           (unsigned long long)stats.culled,
+           (unsigned long long)stats.triangles,
+           (unsigned long long)stats.quads,
+           (unsigned long long)stats.images,
+           (unsigned long long)stats.occluded,
+           (unsigned long long)stats.boundingBoxPixels,
+           tested.empty() ? ""
+                          : (" \"pixels_tested\": " + tested + ",").c_str(),
+           (unsigned long long)stats.pixelsCovered,
+           (unsigned long long)stats.pixelsWritten,
+           stats.boundingBoxEfficiency(), peakKB);
+  } else {
+    printf("%-10s %6u %4u %10.3f %10.3f %10llu %10llu %10llu %12s %12llu"
+           " %5.2f %9ld\n",
+           scene.name, resolution, threads, best, median,
+           (unsigned long long)stats.painters,
+           (unsigned long long)stats.triangles,
+           (unsigned long long)stats.quads,
+           tested.empty() ? "-" : tested.c_str(),
+           (unsigned long long)stats.pixelsWritten,
+           stats.boundingBoxEfficiency(), peakKB);
+  }
+  fflush(stdout);
+}
+
+// Run each case in a child process, where possible, so that its peak
+// memory use is its own.
+static bool runIsolated(const Scene& scene, uint32_t resolution,
+                        uint32_t threads, const Options& options,
+                        bool first) {
+#ifdef HAVE_FORK
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid == 0) {
+    run(scene, resolution, threads, options, first);
+    _exit(0);
+  }
+  if (pid > 0) {
+    int status;
+    if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status)
+        || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "benchmark %s at %upx failed\n", scene.name,
+              resolution);
+      return false;
+    }
+    return true;
+  }
+#endif
+  run(scene, resolution, threads, options, first);
+  return true;
+}
+
+static bool parseList(const char *arg, std::vector<uint32_t>& out) {
+  out.clear();
+  while (*arg) {
+    char *end;
+    unsigned long n = strtoul(arg, &end, 10);
+    if (end == arg || (*end && *end != ','))
+      return false;
+    out.push_back(n);
+    arg = *end ? end + 1 : end;
+  }
+  return !out.empty();
+}
+
+static void usage(const char *argv0) {
+  fprintf(stderr,
+          "usage: %s [--json] [--antialias] [--fixed-point]\n"
+          "          [--bins TILESIZE] [--front-to-back] [--null-backend]\n"
+          "          [--repaint]\n"
+          "          [--resolutions N,...]\n"
+          "          [--threads N,...] [--iterations N] [--trace DIR]\n"
+          "          [SCENE...]\n"
+          "Thread count 0 means one per core.  --trace writes a Chrome\n"
+          "trace of a paint of each case into DIR.  --bins draws\n"
+          "into per-tile command bins, flushed tile by tile.\n"
+          "--front-to-back paints a display list of each scene front\n"
+          "to back, on one thread.  --null-backend paints into a\n"
+          "backend that only counts what it is sent, on one thread.\n"
+          "--repaint times moving a small square over each scene,\n"
+          "repainting only what changes.  Scenes:", argv0);
+  for (const Scene& scene : scenes)
+    fprintf(stderr, " %s", scene.name);
+  fprintf(stderr, "\n");
+}
+
+int main (int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    const char *arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (!strcmp(arg, "--json")) {
+      options.json = true;
+    } else if (!strcmp(arg, "--antialias")) {
+      options.antialias = true;
+    } else if (!strcmp(arg, "--fixed-point")) {
+      options.fixedPoint = true;
+    } else if (!strcmp(arg, "--front-to-back")) {
+      options.frontToBack = true;
+    } else if (!strcmp(arg, "--null-backend")) {
+      options.nullBackend = true;
+    } else if (!strcmp(arg, "--repaint")) {
+      options.repaint = true;
+    } else if (!strcmp(arg, "--bins") && hasValue) {
+      options.binSize = atoi(argv[++i]);
+    } else if (!strcmp(arg, "--resolutions") && hasValue) {
+      if (!parseList(argv[++i], options.resolutions)) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(arg, "--threads") && hasValue) {
+      if (!parseList(argv[++i], options.threads)) {
+        usage(argv[0]);
+        return 1;
+      }
+    } else if (!strcmp(arg, "--iterations") && hasValue) {
+      options.iterations = atoi(argv[++i]);
+    } else if (!strcmp(arg, "--trace") && hasValue) {
+      options.traceDir = argv[++i];
+    } else if (arg[0] == '-') {
+      usage(argv[0]);
+      return 1;
+    } else {
+      options.scenes.push_back(arg);
+    }
+  }
+  for (const std::string& name : options.scenes) {
+    if (std::none_of(std::begin(scenes), std::end(scenes),
+                     [&](const Scene& s) { return name == s.name; })) {
+      fprintf(stderr, "unknown scene: %s\n", name.c_str());
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (options.json) {
+    printf("{\n  \"compiler\": \"%s\",\n  \"cases\": [\n", __VERSION__);
+  } else {
+    printf("%-10s %6s %4s %10s %10s %10s %10s %10s %12s %12s %5s %9s\n",
+           "scene", "res", "thr", "best ms", "median ms", "painters",
+           "triangles", "quads", "tested", "written", "bbox", "peak KB");
+  }
+
+  bool first = true, ok = true;
+  for (const Scene& scene : scenes) {
+    if (!options.scenes.empty()
+        && std::find(options.scenes.begin(), options.scenes.end(),
+                     scene.name) == options.scenes.end())
+      continue;
+    for (uint32_t resolution : options.resolutions) {
+      for (uint32_t threads : options.threads) {
+        ok = runIsolated(scene, resolution, threads, options, first) && ok;
+        first = false;
+      }
+    }
+  }
+
+  if (options.json)
+    printf("\n  ]\n}\n");
+  return ok ? 0 : 1;
+}
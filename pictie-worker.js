@@ -0,0 +1,124 @@
+// Evaluates pictie expressions and paints the resulting painters off
+// the main thread.  Runs as a web worker, or as a node worker_threads
+// worker for testing.  Requires pictie.module.js; see the Makefile.
+//
+// Messages to the worker:
+//
+//   {type: 'eval', id, expr, width, height, bandHeight, canvas}
+//     Evaluates EXPR and replies with a 'result'.  If the value is a
+//     painter, it is painted at WIDTH by HEIGHT pixels, BANDHEIGHT rows
+//     at a time, posting a 'band' as each band is finished and then a
+//     'done'.  If CANVAS, an OffscreenCanvas, is given, bands are
+//     drawn into it; otherwise their RGBA pixels are sent in the 'band'
+//     message.
+//
+//   {type: 'cancel'}
+//     Stops any render requested before this message, after its
+//     current band, replying 'cancelled' for it instead of 'done'.
+//
+// Messages from the worker:
+//
+//   {type: 'ready'}
+//   {type: 'result', id, def, painter, repr, error}
+//     DEF is the name of the global that holds the value, as in the
+//     workbench.  PAINTER is true if the value is a painter, which will
+//     be followed by bands.
+//   {type: 'band', id, y, rows, rgba}
+//   {type: 'done', id}
+//   {type: 'cancelled', id}
+//   {type: 'error', id, error}
+//     Painting failed.
+
+'use strict';
+
+let post, listen, loadModule;
+if (typeof importScripts === 'function') {
+  importScripts('pictie.module.js');
+  post = (msg, transfer) => postMessage(msg, transfer || []);
+  listen = f => { onmessage = event => f(event.data); };
+  loadModule = () => createPictie();
+} else {
+  const { parentPort } = require('worker_threads');
+  post = (msg, transfer) => parentPort.postMessage(msg, transfer || []);
+  listen = f => parentPort.on('message', f);
+  loadModule = () => require('./pictie.module.js')();
+}
+
+// Yield to the event loop, so that a 'cancel' can arrive between bands.
+let yieldToEvents = () => new Promise(resolve => setTimeout(resolve, 0));
+
+let Module;
+let defCount = 0;
+// Incremented by each 'cancel'; a render stops when the epoch it was
+// requested in is over.
+let epoch = 0;
+
+let render = async (id, requestEpoch, painter, width, height, bandHeight,
+                    canvas) => {
+  let ctx = canvas ? canvas.getContext('2d') : null;
+  for (let y = 0; y < height; y += bandHeight) {
+    await yieldToEvents();
+    if (requestEpoch !== epoch) {
+      post({type: 'cancelled', id});
+      return;
+    }
+    let rows = Math.min(bandHeight, height - y);
+    let cx = new Module.DrawingContext(width, height, y, rows);
+    Module.paint(cx, painter);
+    // Copy the band out of wasm memory before the context goes away.
+    let rgba = cx.getRGBA().slice();
+    cx.delete();
+    if (ctx) {
+      let data = new ImageData(new Uint8ClampedArray(rgba.buffer), width, rows);
+      ctx.putImageData(data, 0, y);
+      post({type: 'band', id, y, rows});
+    } else {
+      post({type: 'band', id, y, rows, rgba: rgba.buffer}, [rgba.buffer]);
+    }
+  }
+  post({type: 'done', id});
+};
+
+let evaluate = async ({id, expr, width, height, bandHeight, canvas},
+                      requestEpoch) => {
+  let result;
+  try {
+    result = (0, eval)(expr);
+  } catch (e) {
+    post({type: 'result', id, error: e.toString()});
+    return;
+  }
+  if (typeof result === 'undefined' || result === null) {
+    post({type: 'result', id});
+    return;
+  }
+  let def = '$' + defCount++;
+  globalThis[def] = result;
+  if (!(result instanceof Module.Painter)) {
+    post({type: 'result', id, def, repr: '' + result});
+    return;
+  }
+  post({type: 'result', id, def, painter: true});
+  await render(id, requestEpoch, result, width || 250, height || 250,
+               bandHeight || 32, canvas);
+};
+
+// Requests are handled one at a time, in order, so that definitions
+// are made in the order that they were sent.
+let queue = loadModule().then(M => {
+  Module = M;
+  for (let k in Module)
+    if (!(k in globalThis))
+      globalThis[k] = Module[k];
+  post({type: 'ready'});
+});
+
+listen(msg => {
+  if (msg.type === 'cancel') {
+    epoch++;
+    return;
+  }
+  let requestEpoch = epoch;
+  queue = queue.then(() => evaluate(msg, requestEpoch))
+    .catch(e => post({type: 'error', id: msg.id, error: e.toString()}));
+});
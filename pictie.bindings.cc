@@ -53,8 +53,24 @@ EMSCRIPTEN_BINDINGS(interface_tests) {
     .value("Unscaled", LineWidthScaling::Unscaled)
     ;
 
+  enum_<LineJoinStyle>("LineJoinStyle")
+    .value("None", LineJoinStyle::None)
+    .value("Miter", LineJoinStyle::Miter)
+    .value("Bevel", LineJoinStyle::Bevel)
+    .value("Round", LineJoinStyle::Round)
+    ;
+
+  enum_<ImageSampling>("ImageSampling")
+    .value("Nearest", ImageSampling::Nearest)
+    .value("Bilinear", ImageSampling::Bilinear)
+    .value("Mipmap", ImageSampling::Mipmap)
+    ;
+
   class_<DrawingContext>("DrawingContext")
     .constructor<uint32_t>()
+    .constructor<uint32_t, uint32_t>()
+    .constructor<uint32_t, uint32_t, uint32_t, uint32_t>()
+    .constructor<RenderBackend&, uint32_t, uint32_t>()
     .function("fill", &DrawingContext::fill)
     .function("drawTriangle", &DrawingContext::drawTriangle)
     .function("drawQuad", &DrawingContext::drawQuad)
@@ -62,6 +78,149 @@ EMSCRIPTEN_BINDINGS(interface_tests) {
     // FIXME: .function("drawPixels", &DrawingContext::drawPixels)
     // FIXME: .function("writePPM", &DrawingContext::writePPM)
     .function("getPixels", &DrawingContext::getPixels)
+    // A Uint8Array view of the RGBA pixels in wasm memory, without a
+    // copy.  It is only valid until memory grows or the next call.
+    .function("getRGBA", optional_override([](DrawingContext& cx) {
+                const std::vector<uint8_t>& rgba = cx.getRGBA();
+                return val(typed_memory_view(rgba.size(), rgba.data()));
+              }))
+    .function("firstRow", &DrawingContext::firstRow)
+    .function("cullThreshold", &DrawingContext::cullThreshold)
+    .function("setCullThreshold", &DrawingContext::setCullThreshold)
+    .function("antialiasing", &DrawingContext::antialiasing)
+    .function("setAntialiasing", &DrawingContext::setAntialiasing)
+    .function("fixedPoint", &DrawingContext::fixedPoint)
+    .function("setFixedPoint", &DrawingContext::setFixedPoint)
+    .function("renderCache", &DrawingContext::renderCache, allow_raw_pointers())
+    .function("setRenderCache", &DrawingContext::setRenderCache, allow_raw_pointers())
+    // A plain object of the counters, as numbers rather than BigInts.
+    .function("stats", optional_override([](const DrawingContext& cx) {
+                const RenderStats& stats = cx.stats();
+                val ret = val::object();
+                ret.set("painters", double(stats.painters));
+                ret.set("transforms", double(stats.transforms));
+                ret.set("culled", double(stats.culled));
+                ret.set("triangles", double(stats.triangles));
+                ret.set("quads", double(stats.quads));
+                ret.set("images", double(stats.images));
+                ret.set("occluded", double(stats.occluded));
+                ret.set("boundingBoxPixels", double(stats.boundingBoxPixels));
+                ret.set("pixelsTested", double(stats.pixelsTested));
+                ret.set("pixelsCovered", double(stats.pixelsCovered));
+                ret.set("pixelsWritten", double(stats.pixelsWritten));
+                ret.set("boundingBoxEfficiency", stats.boundingBoxEfficiency());
+                return ret;
+              }))
+    .function("resetStats", &DrawingContext::resetStats)
+    .function("trace", &DrawingContext::trace, allow_raw_pointers())
+    .function("setTrace", &DrawingContext::setTrace, allow_raw_pointers())
+    .function("bins", &DrawingContext::bins, allow_raw_pointers())
+    .function("setBins", &DrawingContext::setBins, allow_raw_pointers())
+    .function("flush", optional_override([](DrawingContext& cx) {
+                cx.flush();
+              }))
+    .function("flush", &DrawingContext::flush)
+    ;
+
+  class_<CommandBins>("CommandBins")
+    .constructor<>()
+    .constructor<uint32_t>()
+    .function("tileSize", &CommandBins::tileSize)
+    .function("columns", &CommandBins::columns)
+    .function("rows", &CommandBins::rows)
+    .function("size", &CommandBins::size)
+    .function("empty", &CommandBins::empty)
+    ;
+
+  class_<RenderTrace>("RenderTrace")
+    .constructor<>()
+    .function("size", &RenderTrace::size)
+    .function("clear", &RenderTrace::clear)
+    .function("toJSON", &RenderTrace::toJSON)
+    ;
+
+  class_<RenderCache>("RenderCache")
+    .constructor<size_t>()
+    .function("maxBytes", &RenderCache::maxBytes)
+    .function("bytes", &RenderCache::bytes)
+    .function("hits", &RenderCache::hits)
+    .function("misses", &RenderCache::misses)
+    .function("clear", &RenderCache::clear)
+    ;
+
+  class_<RenderBackend>("RenderBackend");
+
+  class_<CountingBackend, base<RenderBackend>>("CountingBackend")
+    .constructor<>()
+    // A plain object of the counts, as numbers rather than BigInts.
+    .function("counts", optional_override([](const CountingBackend& counts) {
+                val ret = val::object();
+                ret.set("fills", double(counts.fills));
+                ret.set("triangles", double(counts.triangles));
+                ret.set("quads", double(counts.quads));
+                ret.set("images", double(counts.images));
+                return ret;
+              }))
+    .function("reset", &CountingBackend::reset)
+    ;
+
+  class_<SVGBackend, base<RenderBackend>>("SVGBackend")
+    .constructor<uint32_t, uint32_t>()
+    .function("width", &SVGBackend::width)
+    .function("height", &SVGBackend::height)
+    .function("clear", &SVGBackend::clear)
+    .function("toSVG", &SVGBackend::toSVG)
+    ;
+
+  class_<DisplayList, base<RenderBackend>>("DisplayList")
+    .function("size", &DisplayList::size)
+    .function("replay", &DisplayList::replay)
+    .function("paint", &DisplayList::paint)
+    .function("replayFrontToBack", &DisplayList::replayFrontToBack)
+    .function("paintFrontToBack", &DisplayList::paintFrontToBack)
+    ;
+
+  class_<PainterArena>("PainterArena")
+    .smart_ptr_constructor("PainterArena", &std::make_shared<PainterArena>)
+    .function("size", &PainterArena::size)
+    .function("reserve", &PainterArena::reserve)
+    .function("triangle", &PainterArena::triangle)
+    .function("path", optional_override([](PainterArena& arena,
+                                           const std::vector<Vector>& points,
+                                           const Color& color, double width,
+                                           LineCapStyle lineCapStyle,
+                                           LineWidthScaling widthScaling) {
+                return arena.path(points, color, width, lineCapStyle,
+                                  widthScaling);
+              }))
+    .function("path", &PainterArena::path)
+    .function("segments", &PainterArena::segments)
+    .function("image", optional_override([](PainterArena& arena,
+                                            uint32_t width, uint32_t height,
+                                            const std::vector<Color>& pixels) {
+                return arena.image(width, height, pixels);
+              }))
+    .function("image", &PainterArena::image)
+    .function("transform", select_overload<PainterId(PainterId, const Vector&, const Vector&, const Vector&)>(&PainterArena::transform))
+    .function("over", &PainterArena::over)
+    .function("opacity", &PainterArena::opacity)
+    .function("parallelogram", &PainterArena::parallelogram)
+    .function("color", &PainterArena::color)
+    .function("flipHoriz", &PainterArena::flipHoriz)
+    .function("flipVert", &PainterArena::flipVert)
+    .function("rotate90", &PainterArena::rotate90)
+    .function("rotate180", &PainterArena::rotate180)
+    .function("rotate270", &PainterArena::rotate270)
+    .function("beside", &PainterArena::beside)
+    .function("below", &PainterArena::below)
+    .function("beside3", &PainterArena::beside3)
+    .function("above3", &PainterArena::above3)
+    .function("paint", &PainterArena::paint)
+    .function("save", optional_override([](const PainterArena& arena,
+                                           std::string fname,
+                                           PainterId root) {
+                return arena.save(fname.c_str(), root);
+              }))
     ;
 
   class_<Painter>("Painter")
@@ -70,10 +229,31 @@ EMSCRIPTEN_BINDINGS(interface_tests) {
     ;
 
   function("triangle", &triangle);
+  function("path", optional_override([](const std::vector<Vector>& points,
+                                        const Color& color, double width,
+                                        LineCapStyle lineCapStyle,
+                                        LineWidthScaling widthScaling) {
+             return path(points, color, width, lineCapStyle, widthScaling);
+           }));
   function("path", &path);
-  function("image", &image);
+  function("segments", &segments);
+  // Embind dispatches on the number of arguments, not on defaults.
+  function("image", optional_override([](uint32_t width, uint32_t height,
+                                         std::vector<Color> pixels) {
+             return image(width, height, std::move(pixels));
+           }));
+  function("image", select_overload<PainterPtr(uint32_t, uint32_t, std::vector<Color>&&, ImageSampling)>(&image));
+  function("imageFromPPM", optional_override([](std::string fname) {
+             return image(fname.c_str());
+           }));
+  function("imageFromPPM", optional_override([](std::string fname,
+                                                ImageSampling sampling) {
+             return image(fname.c_str(), sampling);
+           }));
   function("transform", &transform);
-  function("over", &over);
+  function("over", select_overload<PainterPtr(PainterPtr, PainterPtr)>(&over));
+  function("over", select_overload<PainterPtr(PainterPtr, PainterPtr, double)>(&over));
+  function("opacity", &opacity);
   function("parallelogram", &parallelogram);
   function("color", &color);
   function("flipHoriz", &flipHoriz);
@@ -91,5 +271,57 @@ EMSCRIPTEN_BINDINGS(interface_tests) {
   function("blue", &blue);
   function("red", &red);
 
+  function("painter", optional_override(
+             [](std::shared_ptr<PainterArena> arena, PainterId root) {
+               return painter(arena, root);
+             }));
+  // Scene files live in the emscripten file system, as with
+  // imageFromPPM.
+  function("saveScene", optional_override([](std::string fname,
+                                             PainterPtr p) {
+             return saveScene(fname.c_str(), p);
+           }));
+  function("loadScene", optional_override([](std::string fname) {
+             return loadScene(fname.c_str());
+           }));
+  function("countNodes", &countNodes);
+  function("simplify", optional_override([](PainterPtr p) {
+             return simplify(p);
+           }));
+  function("compile", &compile);
+#ifdef __EMSCRIPTEN_PTHREADS__
+  // In the threaded build, paint uses every thread in the pool.
+  function("paint", optional_override([](DrawingContext& cx, PainterPtr p) {
+             paintParallel(cx, p);
+           }));
+#else
   function("paint", &paint);
+#endif
+  function("paintParallel", optional_override([](DrawingContext& cx,
+                                                 PainterPtr p,
+                                                 uint32_t threads) {
+             paintParallel(cx, p, threads);
+           }));
+  function("parallelism", &parallelism);
+  // Before may be null, for the first paint.
+  function("repaint", optional_override([](DrawingContext& cx,
+                                           PainterPtr before,
+                                           PainterPtr after) {
+             repaint(cx, before, after);
+           }));
+  // An array of {x0, y0, x1, y1} objects.
+  function("damage", optional_override([](const DrawingContext& cx,
+                                          PainterPtr before,
+                                          PainterPtr after) {
+             val ret = val::array();
+             for (const PixelRect& rect : damage(cx, before, after)) {
+               val r = val::object();
+               r.set("x0", rect.x0);
+               r.set("y0", rect.y0);
+               r.set("x1", rect.x1);
+               r.set("y1", rect.y1);
+               ret.call<void>("push", r);
+             }
+             return ret;
+           }));
 }
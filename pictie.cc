@@ -1,29 +1,39 @@
+#include <ctype.h>
 #include <stdio.h>
-#include "pictie.h"
+#include <string.h>
 
-DrawingContext::DrawingContext(uint32_t resolution)
-  : width_(resolution), height_(resolution),
-    canvasFrame_(Vector(0,resolution),
-                 Vector(resolution,0),
-                 Vector(0,-double(resolution))),
-    pixels_(resolution * resolution) {
-  fill(Color::white());
-}
-  
-void DrawingContext::fill(const Color& color) {
-  for (uint32_t y = 0; y < height_; y++)
-    for (uint32_t x = 0; x < width_; x++)
-      pixels_[y * width_ + x] = color;
-}
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define HAVE_MMAP 1
+#endif
 
-static bool rightOf(const Vector &a, const Vector &b, const Vector &c) {
-  return (c.x - a.x) * (b.y - a.y) - (c.y - a.y) * (b.x - a.x) >= 0;
-}
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
-static bool insideTriangle(const Vector& a, const Vector &b, const Vector &c,
-                           const Vector& p) {
-  return rightOf(a, b, p) && rightOf(b, c, p) && rightOf(c, a, p);
-}
+#if defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__wasm_simd128__)
+#include <wasm_simd128.h>
+#endif
+
+#include "pictie.h"
+
+static_assert(sizeof(Color) == 3, "Color should be packed RGB");
+
+// Update a RenderStats counter, unless stats are compiled out.
+#ifdef PICTIE_NO_STATS
+#define COUNT(expr) do {} while (0)
+#else
+#define COUNT(expr) do { expr; } while (0)
+#endif
 
 template<typename T>
 static T min(T a, T b) { return a < b ? a : b; }
@@ -42,345 +52,4196 @@ static T max(T a, T b, T c, T d) { return max(max(a, b), max(c, d)); }
 template<typename T>
 static T clamp(T lo, T x, T hi) { return max(lo, min(x, hi)); }
 
-void DrawingContext::drawTriangle(const Vector& a, const Vector& b,
-                                  const Vector& c, const Color& color) {
-  Vector ca = canvasFrame_.project(a);
-  Vector cb = canvasFrame_.project(b);
-  Vector cc = canvasFrame_.project(c);
-  uint32_t miny = floor(clamp(0.0, min(ca.y, cb.y, cc.y), double(height_)));
-  uint32_t maxy = ceil(clamp(0.0, max(ca.y, cb.y, cc.y), double(height_)));
-  uint32_t minx = floor(clamp(0.0, min(ca.x, cb.x, cc.x), double(width_)));
-  uint32_t maxx = ceil(clamp(0.0, max(ca.x, cb.x, cc.x), double(width_)));
+// Kernels to store a run of N copies of a color.  As Color is packed
+// RGB, 16 pixels are exactly three 16-byte vectors, so the vector
+// kernels fill a block of 16 or 32 pixels once and then store that
+// block repeatedly, finishing the tail one pixel at a time.  Short
+// runs, such as the spans of thin lines, aren't worth setting up for.
+static void fillPixelsScalar(Color* dst, size_t n, const Color& color) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = color;
+}
 
-  if (!rightOf(ca, cb, cc))
-    std::swap(cb, cc);
+#if defined(__SSE2__)
+static void fillPixelsSSE2(Color* dst, size_t n, const Color& color) {
+  if (n < 16)
+    return fillPixelsScalar(dst, n, color);
+  Color block[16];
+  fillPixelsScalar(block, 16, color);
+  __m128i v0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+  __m128i v1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block) + 1);
+  __m128i v2 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block) + 2);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i *out = reinterpret_cast<__m128i*>(dst + i);
+    _mm_storeu_si128(out, v0);
+    _mm_storeu_si128(out + 1, v1);
+    _mm_storeu_si128(out + 2, v2);
+  }
+  fillPixelsScalar(dst + i, n - i, color);
+}
 
-  for (uint32_t y = miny; y < maxy; y++)
-    for (uint32_t x = minx; x < maxx; x++)
-      if (insideTriangle(ca, cb, cc, Vector(double(x) + 0.5, double(y) + 0.5)))
-        pixels_[y * width_ + x] = color;
+__attribute__((target("avx2")))
+static void fillPixelsAVX2(Color* dst, size_t n, const Color& color) {
+  if (n < 32)
+    return fillPixelsSSE2(dst, n, color);
+  Color block[32];
+  fillPixelsScalar(block, 32, color);
+  __m256i v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+  __m256i v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block) + 1);
+  __m256i v2 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block) + 2);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i *out = reinterpret_cast<__m256i*>(dst + i);
+    _mm256_storeu_si256(out, v0);
+    _mm256_storeu_si256(out + 1, v1);
+    _mm256_storeu_si256(out + 2, v2);
+  }
+  fillPixelsSSE2(dst + i, n - i, color);
+}
+#elif defined(__wasm_simd128__)
+static void fillPixelsSIMD128(Color* dst, size_t n, const Color& color) {
+  if (n < 16)
+    return fillPixelsScalar(dst, n, color);
+  Color block[16];
+  fillPixelsScalar(block, 16, color);
+  v128_t v0 = wasm_v128_load(block);
+  v128_t v1 = wasm_v128_load(reinterpret_cast<uint8_t*>(block) + 16);
+  v128_t v2 = wasm_v128_load(reinterpret_cast<uint8_t*>(block) + 32);
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    uint8_t *out = reinterpret_cast<uint8_t*>(dst + i);
+    wasm_v128_store(out, v0);
+    wasm_v128_store(out + 16, v1);
+    wasm_v128_store(out + 32, v2);
+  }
+  fillPixelsScalar(dst + i, n - i, color);
 }
+#endif
 
-void DrawingContext::drawQuad(const Vector& a, const Vector &b,
-                              const Vector &c, const Vector& d,
-                              const Color& color) {
-  drawTriangle(a, b, c, color);
-  drawTriangle(c, d, a, color);
+using FillPixels = void (*)(Color*, size_t, const Color&);
+
+static FillPixels chooseFillPixels() {
+#if defined(__SSE2__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return fillPixelsAVX2;
+  return fillPixelsSSE2;
+#elif defined(__wasm_simd128__)
+  return fillPixelsSIMD128;
+#else
+  return fillPixelsScalar;
+#endif
 }
-    
-void DrawingContext::drawLine(const Vector& a, const Vector &b,
-                              const Color& color, double width,
-                              LineCapStyle lineCapStyle) {
-  Vector q = b.sub(a).normalize(width * 0.5);
-  Vector r = q.rotate90DegreesClockwise();
-    
-  switch (lineCapStyle) {
-  case LineCapStyle::Butt:
-    drawQuad(a.add(r), b.add(r), b.sub(r), a.sub(r), color);
-    break;
-  case LineCapStyle::Square:
-    drawQuad(a.sub(q).add(r), b.add(q).add(r), b.add(q).sub(r),
-             a.sub(q).sub(r),
-             color);
-    break;
+
+static void fillPixels(Color* dst, size_t n, const Color& color) {
+  if (n < 16)
+    return fillPixelsScalar(dst, n, color);
+  static const FillPixels impl = chooseFillPixels();
+  impl(dst, n, color);
+}
+
+// Kernels to blend N bytes of SRC into DST, weighting SRC by ALPHA/256,
+// for ALPHA from 0 to 256.  As the weight is the same for every
+// channel, pixel layout doesn't matter, and the vector kernels blend 16
+// bytes at a time in 16-bit lanes.  All of them round the same way.
+static void blendBytesScalar(uint8_t* dst, const uint8_t* src, size_t n,
+                             uint32_t alpha) {
+  for (size_t i = 0; i < n; i++)
+    dst[i] = (dst[i] * (256 - alpha) + src[i] * alpha + 128) >> 8;
+}
+
+#if defined(__SSE2__)
+static void blendBytes(uint8_t* dst, const uint8_t* src, size_t n,
+                       uint32_t alpha) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i a = _mm_set1_epi16(alpha);
+  const __m128i inv = _mm_set1_epi16(256 - alpha);
+  const __m128i round = _mm_set1_epi16(128);
+  auto lanes = [&](__m128i d, __m128i s) {
+    __m128i sum = _mm_add_epi16(_mm_mullo_epi16(d, inv),
+                                _mm_mullo_epi16(s, a));
+    return _mm_srli_epi16(_mm_add_epi16(sum, round), 8);
+  };
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+    __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i lo = lanes(_mm_unpacklo_epi8(d, zero), _mm_unpacklo_epi8(s, zero));
+    __m128i hi = lanes(_mm_unpackhi_epi8(d, zero), _mm_unpackhi_epi8(s, zero));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                     _mm_packus_epi16(lo, hi));
   }
+  blendBytesScalar(dst + i, src + i, n - i, alpha);
 }
-    
-void DrawingContext::drawPixels(uint32_t pixelWidth, uint32_t pixelHeight,
-                                const Color* pixels, const Vector& origin,
-                                const Vector& edge1, const Vector& edge2) {
-  Vector dx = edge1.scale(1./pixelWidth);
-  Vector dy = edge2.scale(1./pixelHeight);
-  Vector row = origin;
-  for (uint32_t y = 0; y < pixelHeight; y++, row = row.add(dy)) {
-    Vector p = row;
-    for (uint32_t x = 0; x < pixelWidth; x++, p = p.add(dx))
-      drawQuad(p, p.add(dx), p.add(dx).add(dy), p.add(dy),
-               pixels[(pixelHeight - y - 1) * pixelWidth + x]);
+#elif defined(__wasm_simd128__)
+static void blendBytes(uint8_t* dst, const uint8_t* src, size_t n,
+                       uint32_t alpha) {
+  const v128_t a = wasm_i16x8_splat(alpha);
+  const v128_t inv = wasm_i16x8_splat(256 - alpha);
+  const v128_t round = wasm_i16x8_splat(128);
+  auto lanes = [&](v128_t d, v128_t s) {
+    v128_t sum = wasm_i16x8_add(wasm_i16x8_mul(d, inv), wasm_i16x8_mul(s, a));
+    return wasm_u16x8_shr(wasm_i16x8_add(sum, round), 8);
+  };
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    v128_t d = wasm_v128_load(dst + i);
+    v128_t s = wasm_v128_load(src + i);
+    v128_t lo = lanes(wasm_u16x8_extend_low_u8x16(d),
+                      wasm_u16x8_extend_low_u8x16(s));
+    v128_t hi = lanes(wasm_u16x8_extend_high_u8x16(d),
+                      wasm_u16x8_extend_high_u8x16(s));
+    wasm_v128_store(dst + i, wasm_u8x16_narrow_i16x8(lo, hi));
   }
+  blendBytesScalar(dst + i, src + i, n - i, alpha);
+}
+#else
+static void blendBytes(uint8_t* dst, const uint8_t* src, size_t n,
+                       uint32_t alpha) {
+  blendBytesScalar(dst, src, n, alpha);
 }
+#endif
 
-bool DrawingContext::writePPM(const char *fname) {
-  FILE *f = fopen(fname, "w");
-  if (!f) {
-    fprintf(stderr, "failed to create %s: ", fname);
-    perror(NULL);
-    return false;
+DrawingContext::DrawingContext(uint32_t resolution)
+  : DrawingContext(resolution, resolution, 0, resolution) {}
+
+DrawingContext::DrawingContext(uint32_t width, uint32_t height)
+  : DrawingContext(width, height, 0, height) {}
+
+DrawingContext::DrawingContext(uint32_t width, uint32_t height,
+                               uint32_t firstRow, uint32_t rowCount)
+  : width_(width), height_(height),
+    canvasFrame_(Vector(0,height),
+                 Vector(width,0),
+                 Vector(0,-double(height))),
+    storage_(size_t(width) * rowCount), pixels_(storage_.data()),
+    stride_(width), firstRow_(firstRow), coverage_(nullptr),
+    clip_(0, firstRow, width, firstRow + rowCount), cullThreshold_(0),
+    antialias_(false), fixedPoint_(false), translucent_(false),
+    trace_(nullptr), bins_(nullptr), occlusion_(nullptr),
+    backend_(nullptr), cache_(nullptr) {
+  fill(Color::white());
+}
+
+DrawingContext::DrawingContext(DrawingContext& parent, const PixelRect& clip)
+  : width_(parent.width_), height_(parent.height_),
+    canvasFrame_(parent.canvasFrame_), pixels_(parent.pixels_),
+    stride_(parent.stride_), firstRow_(parent.firstRow_),
+    coverage_(parent.coverage_),
+    clip_(max(clip.x0, parent.clip_.x0),
+          max(clip.y0, parent.clip_.y0),
+          min(clip.x1, parent.clip_.x1),
+          min(clip.y1, parent.clip_.y1)),
+    cullThreshold_(parent.cullThreshold_), antialias_(parent.antialias_),
+    fixedPoint_(parent.fixedPoint_), translucent_(false),
+    trace_(parent.trace_), bins_(nullptr), occlusion_(nullptr),
+    backend_(parent.backend_), cache_(parent.cache_) {}
+
+DrawingContext::DrawingContext(RenderBackend& backend, uint32_t width,
+                               uint32_t height)
+  : width_(width), height_(height),
+    canvasFrame_(Vector(0,height),
+                 Vector(width,0),
+                 Vector(0,-double(height))),
+    pixels_(nullptr), stride_(0), firstRow_(0), coverage_(nullptr),
+    clip_(0, 0, width, height), cullThreshold_(0), antialias_(false),
+    fixedPoint_(false), translucent_(false), trace_(nullptr),
+    bins_(nullptr), occlusion_(nullptr), backend_(&backend),
+    cache_(nullptr) {}
+
+DrawingContext::DrawingContext(const DrawingContext& parent,
+                               const PixelRect& clip, uint32_t stride,
+                               Color* pixels, uint8_t* coverage)
+  : width_(parent.width_), height_(parent.height_),
+    canvasFrame_(parent.canvasFrame_), pixels_(pixels), stride_(stride),
+    firstRow_(clip.y0), coverage_(coverage), clip_(clip),
+    cullThreshold_(parent.cullThreshold_), antialias_(parent.antialias_),
+    fixedPoint_(parent.fixedPoint_), translucent_(false),
+    trace_(parent.trace_), bins_(nullptr), occlusion_(nullptr),
+    backend_(nullptr), cache_(parent.cache_) {}
+  
+void DrawingContext::fill(const Color& color) {
+  flush();
+  if (backend_) {
+    backend_->fill(color);
+    return;
   }
-  fprintf(f, "P6\n%u %u\n255\n", width_, height_);
-  for (uint32_t y = 0; y < height_; y++) {
-    for (uint32_t x = 0; x < width_; x++) {
-      const Color& p = pixels_[y * width_ + x];
-      fprintf(f, "%c%c%c", p.r, p.g, p.b);
-    }
+  if (clip_.empty())
+    return;
+  if (clip_.x0 == 0 && clip_.x1 == stride_ && !coverage_ && !occlusion_) {
+    size_t count = size_t(clip_.y1 - clip_.y0) * stride_;
+    fillPixels(row(clip_.y0), count, color);
+    COUNT(stats_.pixelsWritten += count);
+    return;
   }
-  if (fflush(f) != 0) {
-    perror("writing PPM file failed"); 
-    fclose(f);
+  for (uint32_t y = clip_.y0; y < clip_.y1; y++)
+    fillSpan(y, clip_.x0, clip_.x1, color);
+}
+
+Bounds Bounds::of(const Vector* points, size_t count, double pad) {
+  // Nothing is painted, but there's no need to optimize that.
+  if (count == 0)
+    return unbounded();
+  Vector lo = points[0], hi = points[0];
+  for (size_t i = 1; i < count; i++) {
+    const Vector& p = points[i];
+    lo = Vector(::min(lo.x, p.x), ::min(lo.y, p.y));
+    hi = Vector(::max(hi.x, p.x), ::max(hi.y, p.y));
+  }
+  return Bounds(lo, hi, pad);
+}
+
+Bounds Bounds::join(const Bounds& other) const {
+  return Bounds(Vector(::min(min.x, other.min.x), ::min(min.y, other.min.y)),
+                Vector(::max(max.x, other.max.x), ::max(max.y, other.max.y)),
+                ::max(pad, other.pad));
+}
+
+Bounds Bounds::project(const Frame& frame) const {
+  if (isUnbounded())
+    return *this;
+  return of({ frame.project(min), frame.project(Vector(max.x, min.y)),
+              frame.project(Vector(min.x, max.y)), frame.project(max) },
+            pad);
+}
+
+bool DrawingContext::culls(const Bounds& bounds, const Frame& frame) const {
+  // Backends without a size have to be good for any resolution and clip
+  // rectangle.
+  if ((backend_ && clip_.empty()) || bounds.isUnbounded())
     return false;
+  Bounds b = bounds.project(frame).project(canvasFrame_);
+  // Allow a pixel of slack for rounding in the projection.
+  double pad = b.pad * max(width_, height_) + 1.0;
+  if (b.max.x + pad < clip_.x0 || b.min.x - pad > clip_.x1
+      || b.max.y + pad < clip_.y0 || b.min.y - pad > clip_.y1
+      || (b.max.x - b.min.x < cullThreshold_
+          && b.max.y - b.min.y < cullThreshold_)) {
+    COUNT(stats_.culled++);
+    return true;
   }
-  fclose(f);
-  return true;
+  return false;
 }
-  
-std::vector<Color> DrawingContext::getPixels() const {
-  return pixels_;
+
+PixelRect DrawingContext::clipBounds(const Bounds& bounds,
+                                     const Frame& frame) const {
+  if (bounds.isUnbounded())
+    return clip_;
+  Bounds b = bounds.project(frame).project(canvasFrame_);
+  double pad = b.pad * max(width_, height_) + 1.0;
+  auto within = [](double x, uint32_t lo, uint32_t hi) {
+    return uint32_t(clamp(double(lo), x, double(hi)));
+  };
+  return PixelRect(within(floor(b.min.x - pad), clip_.x0, clip_.x1),
+                   within(floor(b.min.y - pad), clip_.y0, clip_.y1),
+                   within(ceil(b.max.x + pad), clip_.x0, clip_.x1),
+                   within(ceil(b.max.y + pad), clip_.y0, clip_.y1));
 }
 
-class TrianglePainter : public Painter
+static bool rightOf(const Vector &a, const Vector &b, const Vector &c) {
+  return (c.x - a.x) * (b.y - a.y) - (c.y - a.y) * (b.x - a.x) >= 0;
+}
+
+// The edge function for the directed edge from a to b, which is
+// non-negative for points to the right of the edge, as in rightOf.  A
+// pixel is inside a convex polygon if its center is to the right of
+// all of the polygon's edges.
+struct EdgeFunction
 {
-private:
-  const Vector a_;
-  const Vector b_;
-  const Vector c_;
-  const Color color_;
+  double ax, ay;
+  double dx, dy;
 
-public:
-  explicit TrianglePainter(const Vector& a, const Vector& b,
-                           const Vector& c, const Color& color)
-    : a_(a), b_(b), c_(c), color_(color) {}
+  EdgeFunction() : ax(0), ay(0), dx(0), dy(0) {}
+  EdgeFunction(const Vector& a, const Vector& b)
+    : ax(a.x), ay(a.y), dx(b.x - a.x), dy(b.y - a.y) {}
 
-  void paint(DrawingContext &cx, const Frame& frame) const {
-    cx.drawTriangle(frame.project(a_), frame.project(b_),
-                    frame.project(c_), color_);
+  bool inside(double px, double py) const {
+    return (px - ax) * dy - (py - ay) * dx >= 0;
   }
-};
-                      
-class PathPainter : public Painter
-{
-private:
-  std::vector<Vector> points_;
-  const Color color_;
-  double width_;
-  LineCapStyle lineCapStyle_;
-  LineWidthScaling widthScaling_;
 
-public:
-  PathPainter(const std::vector<Vector> points, const Color& color,
-              double width = 1.0,
-              LineCapStyle lineCapStyle = LineCapStyle::Butt,
-              LineWidthScaling widthScaling = LineWidthScaling::Unscaled)
-    : points_(points), color_(color), width_(width),
-      lineCapStyle_(lineCapStyle), widthScaling_(widthScaling) {}
+  // The x coordinate at which the edge crosses the horizontal line Y.
+  double intercept(double y) const { return ax + (y - ay) * dx / dy; }
+  double slope() const { return dx / dy; }
+};
 
-  void paint(DrawingContext &cx, const Frame& frame) const {
-    double width;
-    switch (widthScaling_) {
-    case LineWidthScaling::Scaled: {
-      double diagonal = frame.edge1.add(frame.edge2).magnitude();
-      double unitDiagonal = Vector(1,1).magnitude();
-      width = width_ * diagonal / unitDiagonal;
-      break;
-    }
-    case LineWidthScaling::Unscaled:
-      width = width_;
-      break;
-    default:
-      abort();
-    }
-    for (size_t i = 0; i + 1 < points_.size(); i++)
-      cx.drawLine(frame.project(points_[i]), frame.project(points_[i+1]),
-                  color_, width, lineCapStyle_);
+// Call SPAN(y, x0, x1) for each row of pixels Y in [MINY,MAXY) whose
+// pixel centers in [X0,X1) fall inside the convex polygon bounded by
+// EDGES, which must already be in canvas coordinates and wound as in
+// rightOf.  Pixels outside [MINX,MAXX) are never visited.
+//
+// Rather than testing every pixel in the bounding box, we step the
+// intercepts of the edges with each row's center line, which gives an
+// estimate of the covered span.  Rounding the estimate out by a pixel
+// on each side and then shrinking it with the exact edge tests gives
+// the same coverage as testing each pixel individually.
+template<size_t N, typename SpanFn>
+static void rasterizeConvex(const EdgeFunction (&edges)[N],
+                            uint32_t minx, uint32_t miny,
+                            uint32_t maxx, uint32_t maxy,
+                            uint64_t& tested, SpanFn span) {
+  auto inside = [&](uint32_t x, double py) {
+    COUNT(tested++);
+    double px = double(x) + 0.5;
+    for (const EdgeFunction& e : edges)
+      if (!e.inside(px, py))
+        return false;
+    return true;
   };
-};
-                      
-class ImagePainter : public Painter
-{
-private:
-  uint32_t width_;
-  uint32_t height_;
-  std::vector<Color> pixels_;
 
-public:
-  // Takes ownership of pixels.
-  ImagePainter(uint32_t width, uint32_t height,
-               std::vector<Color>&& pixels)
-    : width_(width), height_(height), pixels_(pixels)
-  {
-    if (width_ * height_ != pixels_.size())
-      abort();
-  }
-  
-  static ImagePainter* fromPPM(const char *fname) {
-    FILE *f = fopen(fname, "r");
-    if (!f) {
-      fprintf(stderr, "failed to open %s: ", fname);
-      perror(NULL);
-      return nullptr;
-    }
-    unsigned int width = 0;
-    unsigned int height = 0;
-    if (fscanf(f, "P6\n%u %u\n255\n", &width, &height) != 2) {
-      fprintf(stderr, "expected PPM header on %s\n", fname);
-      fclose(f);
-      return nullptr;
-    }
-    if (width * height == 0) {
-      fprintf(stderr, "bad dimensions for PPM file %s: %u x %u\n", fname,
-              width, height);
-      fclose(f);
-      return nullptr;
-    }
-    
-    std::vector<Color> pixels(width * height);
-    for (uint32_t y = 0; y < height; y++) {
-      for (uint32_t x = 0; x < width; x++) {
-        int r, g, b;
-        r = fgetc(f); g = fgetc(f); b = fgetc(f);
-        if (r == EOF || g == EOF || b == EOF) {
-          fprintf(stderr, "got EOF while reading PPM data from %s\n", fname);
-          fclose(f);
-          return nullptr;
-        }
-        pixels[y * width + x] = Color(r, g, b);
-      }
+  double py = double(miny) + 0.5;
+  const EdgeFunction *flat[N];
+  double left[N], right[N], leftStep[N], rightStep[N];
+  size_t nflat = 0, nleft = 0, nright = 0;
+  for (const EdgeFunction& e : edges) {
+    if (e.dy > 0) {
+      left[nleft] = e.intercept(py);
+      leftStep[nleft++] = e.slope();
+    } else if (e.dy < 0) {
+      right[nright] = e.intercept(py);
+      rightStep[nright++] = e.slope();
+    } else {
+      flat[nflat++] = &e;
     }
+  }
 
-    if (fgetc(f) != EOF) {
-      fprintf(stderr, "expected EOF after reading PPM data from %s\n", fname);
-      fclose(f);
-      return nullptr;
+  for (uint32_t y = miny; y < maxy; y++, py += 1.0) {
+    double xl = double(minx), xr = double(maxx);
+    for (size_t i = 0; i < nleft; i++) {
+      xl = max(xl, left[i]);
+      left[i] += leftStep[i];
     }
-      
-    fclose(f);
+    for (size_t i = 0; i < nright; i++) {
+      xr = min(xr, right[i]);
+      right[i] += rightStep[i];
+    }
+    bool empty = xl > xr + 2.0;
+    for (size_t i = 0; i < nflat; i++)
+      empty = empty || !flat[i]->inside(flat[i]->ax, py);
+    if (empty)
+      continue;
 
-    return new ImagePainter(width, height, std::move(pixels));
+    int64_t x0 = int64_t(floor(xl - 0.5));
+    int64_t x1 = int64_t(ceil(xr - 0.5)) + 1;
+    uint32_t lo = uint32_t(clamp(int64_t(minx), x0, int64_t(maxx)));
+    uint32_t hi = uint32_t(clamp(int64_t(minx), x1, int64_t(maxx)));
+    while (lo < hi && !inside(lo, py))
+      lo++;
+    while (hi > lo && !inside(hi - 1, py))
+      hi--;
+    if (lo < hi)
+      span(y, lo, hi);
   }
+}
 
-  void paint(DrawingContext &cx, const Frame& frame) const {
-    cx.drawPixels(width_, height_, pixels_.data(), frame.origin, frame.edge1,
-                  frame.edge2);
-  }
-};
-                      
-class TransformPainter : public Painter
+// Which pixels of a clip rectangle are final, for front-to-back
+// drawing, with a count of them for each 32 by 32 tile so that covered
+// tiles can be passed over without looking at their pixels.  The mask
+// has a bit per pixel, so that it mostly stays in cache; a byte per
+// pixel costs a cache miss on nearly every span of a big canvas.
+class OcclusionMask
 {
-private:
-  PainterPtr painter_;
-  const Frame frame_;
+  static const uint32_t kTileShift = 5;
+  static const uint32_t kTileSize = 1 << kTileShift;
 
-public:
-  TransformPainter(PainterPtr painter,
-                   const Vector& origin, const Vector& corner1,
-                   const Vector& corner2)
-    : painter_(painter),
-      frame_(origin, corner1.sub(origin), corner2.sub(origin))
-  {}
-  
-  void paint(DrawingContext &cx, const Frame& frame) const {
-    painter_->paint(cx, frame.project(frame_));
+  const PixelRect clip_;
+  const uint32_t width_;
+  const uint32_t words_;
+  const uint32_t columns_;
+  std::vector<uint64_t> final_;
+  std::vector<uint32_t> counts_;
+
+  // X and Y are relative to the clip from here on.
+  size_t tile(uint32_t x, uint32_t y) const {
+    return size_t(y >> kTileShift) * columns_ + (x >> kTileShift);
+  }
+  // The number of pixels of the tile at X, Y within the clip.
+  uint32_t area(uint32_t x, uint32_t y) const {
+    uint32_t tx = x & ~(kTileSize - 1), ty = y & ~(kTileSize - 1);
+    return min(kTileSize, width_ - tx)
+      * min(kTileSize, clip_.y1 - clip_.y0 - ty);
+  }
+  // The first pixel in [X,END) of ROW that is final if FINAL, or not
+  // final otherwise, or END if there is none.
+  static uint32_t scan(const uint64_t* row, uint32_t x, uint32_t end,
+                       bool final) {
+    while (x < end) {
+      uint64_t bits = final ? row[x >> 6] : ~row[x >> 6];
+      bits &= ~uint64_t(0) << (x & 63);
+      if (bits)
+        return min(end, (x & ~63u) + uint32_t(__builtin_ctzll(bits)));
+      x = (x | 63) + 1;
+    }
+    return end;
+  }
+  static void mark(uint64_t* row, uint32_t lo, uint32_t hi) {
+    while (lo < hi) {
+      uint32_t n = min(hi - lo, 64 - (lo & 63));
+      uint64_t bits = n == 64 ? ~uint64_t(0) : ((uint64_t(1) << n) - 1);
+      row[lo >> 6] |= bits << (lo & 63);
+      lo += n;
+    }
   }
 
-};
+public:
+  explicit OcclusionMask(const PixelRect& clip)
+    : clip_(clip), width_(clip.x1 - clip.x0), words_((width_ + 63) / 64),
+      columns_((width_ + kTileSize - 1) >> kTileShift),
+      final_(size_t(words_) * (clip.y1 - clip.y0), 0),
+      counts_(size_t(columns_)
+              * ((clip.y1 - clip.y0 + kTileSize - 1) >> kTileShift), 0) {}
 
-class OverPainter : public Painter
-{
-private:
-  PainterPtr first_;
-  PainterPtr second_;
+  // Whether every pixel of RECT, which must be within the clip, is
+  // final.  Only whole tiles are checked, so this may say no when the
+  // answer is yes, but never the reverse.
+  bool covers(const PixelRect& rect) const {
+    if (rect.empty())
+      return false;
+    uint32_t x0 = rect.x0 - clip_.x0, x1 = rect.x1 - clip_.x0;
+    uint32_t y0 = rect.y0 - clip_.y0, y1 = rect.y1 - clip_.y0;
+    for (uint32_t y = y0; y < y1; y = (y | (kTileSize - 1)) + 1) {
+      for (uint32_t x = x0; x < x1; x = (x | (kTileSize - 1)) + 1) {
+        if (counts_[tile(x, y)] != area(x, y))
+          return false;
+      }
+    }
+    return true;
+  }
 
-public:
-  OverPainter(PainterPtr first, PainterPtr second)
-    : first_(first), second_(second) {}
-  
-  void paint(DrawingContext &cx, const Frame& frame) const {
-    first_->paint(cx, frame);
-    second_->paint(cx, frame);
+  // Call FILL(lo, hi) for each run of pixels in [X0,X1) of row Y that
+  // isn't final yet, and then mark them final.
+  template<typename FillFn>
+  void claim(uint32_t y, uint32_t x0, uint32_t x1, FillFn fill) {
+    y -= clip_.y0;
+    uint64_t *row = final_.data() + size_t(y) * words_;
+    uint32_t x = x0 - clip_.x0, end = x1 - clip_.x0;
+    while ((x = scan(row, x, end, false)) < end) {
+      uint32_t lo = x;
+      x = scan(row, x, end, true);
+      fill(clip_.x0 + lo, clip_.x0 + x);
+      mark(row, lo, x);
+      for (uint32_t t = lo; t < x; t = (t | (kTileSize - 1)) + 1)
+        counts_[tile(t, y)] += min(x, (t | (kTileSize - 1)) + 1) - t;
+    }
   }
 };
 
-PainterPtr triangle(const Vector& a, const Vector& b, const Vector& c,
-                    const Color& color) {
-  return PainterPtr(new TrianglePainter(a, b, c, color));
+void DrawingContext::fillSpan(uint32_t y, uint32_t x0, uint32_t x1,
+                              const Color& color) {
+  auto fill = [&](uint32_t lo, uint32_t hi) {
+    fillPixels(row(y) + lo, hi - lo, color);
+    COUNT(stats_.pixelsWritten += hi - lo);
+    if (coverage_)
+      memset(coverage_ + size_t(y - firstRow_) * stride_ + lo, 1, hi - lo);
+  };
+  if (occlusion_)
+    occlusion_->claim(y, x0, x1, fill);
+  else
+    fill(x0, x1);
 }
 
-PainterPtr path(const std::vector<Vector> points, const Color& color,
-                double width, LineCapStyle lineCapStyle,
-                LineWidthScaling widthScaling) {
+// Call SPAN(y, x0, x1) for each run of pixels within the clip
+// rectangle that the convex polygon POINTS covers, as in
+// rasterizeConvex.
+template<size_t N, typename SpanFn>
+void DrawingContext::forEachSpan(const Vector (&points)[N], SpanFn span) {
+  double lox = points[0].x, hix = points[0].x;
+  double loy = points[0].y, hiy = points[0].y;
+  EdgeFunction edges[N];
+  for (size_t i = 0; i < N; i++) {
+    lox = min(lox, points[i].x); hix = max(hix, points[i].x);
+    loy = min(loy, points[i].y); hiy = max(hiy, points[i].y);
+    edges[i] = EdgeFunction(points[i], points[(i + 1) % N]);
+  }
+  uint32_t miny = floor(clamp(double(clip_.y0), loy, double(clip_.y1)));
+  uint32_t maxy = ceil(clamp(double(clip_.y0), hiy, double(clip_.y1)));
+  uint32_t minx = floor(clamp(double(clip_.x0), lox, double(clip_.x1)));
+  uint32_t maxx = ceil(clamp(double(clip_.x0), hix, double(clip_.x1)));
+  if (minx >= maxx || miny >= maxy)
+    return;
 
-  return PainterPtr(new PathPainter(std::move(points), color, width,
-                                    lineCapStyle, widthScaling));
+  COUNT(stats_.boundingBoxPixels += uint64_t(maxx - minx) * (maxy - miny));
+  rasterizeConvex(edges, minx, miny, maxx, maxy, stats_.pixelsTested,
+                  [&](uint32_t y, uint32_t x0, uint32_t x1) {
+    COUNT(stats_.pixelsCovered += x1 - x0);
+    span(y, x0, x1);
+  });
 }
 
-PainterPtr image(uint32_t width, uint32_t height, std::vector<Color>&& pixels) {
-  return PainterPtr(new ImagePainter(width, height, std::move(pixels)));
+template<size_t N>
+void DrawingContext::fillConvex(const Vector (&points)[N],
+                                const Color& color) {
+  if (antialias_) {
+    fillConvexAntialiased(points, color);
+    return;
+  }
+  if (fixedPoint_) {
+    fillConvexFixed(points, color);
+    return;
+  }
+  forEachSpan(points, [&](uint32_t y, uint32_t x0, uint32_t x1) {
+    fillSpan(y, x0, x1, color);
+  });
 }
 
-PainterPtr transform(PainterPtr painter,
-                     const Vector& origin, const Vector& corner1,
-                     const Vector& corner2) {
-  return PainterPtr(new TransformPainter(painter, origin, corner1, corner2));
-}
+// Canvas coordinates in fixed point, in 1/256ths of a pixel: 24.8 for
+// canvases of up to a million pixels on a side, with 64 bits for
+// intermediate products.  Vertices further off the canvas than that
+// are clamped, which bends edges that reach that far.
+static const int64_t kSubpixels = 256;
+static const double kMaxFixed = double(int64_t(1) << 20) * kSubpixels;
 
-PainterPtr over(PainterPtr a, PainterPtr b) {
-  return PainterPtr(new OverPainter(a, b));
+// Round to the nearest fixed-point value, halves up.  Rounding by hand
+// instead of with lrint doesn't depend on the rounding mode.
+static int64_t toFixed(double x) {
+  return int64_t(floor(clamp(-kMaxFixed, x * kSubpixels, kMaxFixed) + 0.5));
 }
 
-PainterPtr parallelogram(const Vector& origin, const Vector& edge1,
-                         const Vector& edge2, const Color& color) {
-  return over(triangle(origin, origin.add(edge1),
-                       origin.add(edge1).add(edge2), color),
-              triangle(origin, origin.add(edge1).add(edge2),
-                       origin.add(edge2), color));
+// Division rounding down and up, for positive B.
+static int64_t floorDiv(int64_t a, int64_t b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
 }
-              
-PainterPtr color(const Color& color) {
-  return parallelogram(Vector(0,0), Vector(1,0), Vector(0,1), color);
+static int64_t ceilDiv(int64_t a, int64_t b) {
+  return -floorDiv(-a, b);
 }
 
-PainterPtr flipHoriz(PainterPtr painter) {
-  return transform(painter, Vector(1, 0), Vector(0, 0), Vector(1, 1));
-};
+// EdgeFunction, in fixed point.  Pixel centers exactly on the edge are
+// only inside if BIAS is zero, which is so for edges heading down the
+// canvas, or heading right along a row.  Of two primitives that share
+// an edge, wound the same way, one traverses it in each direction, so
+// exactly one of them gets those pixels.
+struct FixedEdge
+{
+  int64_t ax, ay;
+  int64_t dx, dy;
+  int64_t bias;
 
-PainterPtr flipVert(PainterPtr painter) {
-  return transform(painter, Vector(0, 1), Vector(1, 1), Vector(0, 0));
+  FixedEdge() : ax(0), ay(0), dx(0), dy(0), bias(0) {}
+  FixedEdge(int64_t ax, int64_t ay, int64_t bx, int64_t by)
+    : ax(ax), ay(ay), dx(bx - ax), dy(by - ay),
+      bias(dy > 0 || (dy == 0 && dx > 0) ? 0 : 1) {}
 };
 
-PainterPtr rotate90(PainterPtr painter) {
-  return transform(painter,Vector(1, 0), Vector(1, 1), Vector(0, 0));
-};
+// Like fillConvex, but in fixed point.  Instead of testing pixels, the
+// span in each row is solved for exactly: along the row through pixel
+// centers PY, the edge function is X * 256 * DY + C, so each edge
+// bounds X on one side with a single division.
+template<size_t N>
+void DrawingContext::fillConvexFixed(const Vector (&points)[N],
+                                     const Color& color) {
+  const int64_t half = kSubpixels / 2;
+  int64_t xs[N], ys[N];
+  for (size_t i = 0; i < N; i++) {
+    xs[i] = toFixed(points[i].x);
+    ys[i] = toFixed(points[i].y);
+  }
+  int64_t lox = xs[0], hix = xs[0], loy = ys[0], hiy = ys[0];
+  FixedEdge edges[N];
+  for (size_t i = 0; i < N; i++) {
+    lox = min(lox, xs[i]); hix = max(hix, xs[i]);
+    loy = min(loy, ys[i]); hiy = max(hiy, ys[i]);
+    edges[i] = FixedEdge(xs[i], ys[i], xs[(i + 1) % N], ys[(i + 1) % N]);
+  }
+  // The pixels whose centers are within the bounding box.
+  int64_t minx = max(ceilDiv(lox - half, kSubpixels), int64_t(clip_.x0));
+  int64_t maxx = min(floorDiv(hix - half, kSubpixels) + 1, int64_t(clip_.x1));
+  int64_t miny = max(ceilDiv(loy - half, kSubpixels), int64_t(clip_.y0));
+  int64_t maxy = min(floorDiv(hiy - half, kSubpixels) + 1, int64_t(clip_.y1));
+  if (minx >= maxx || miny >= maxy)
+    return;
 
-PainterPtr rotate180(PainterPtr painter) {
-  return rotate90(rotate90(painter));
-};
+  COUNT(stats_.boundingBoxPixels += uint64_t(maxx - minx) * (maxy - miny));
+  for (int64_t y = miny; y < maxy; y++) {
+    int64_t py = y * kSubpixels + half;
+    int64_t lo = minx, hi = maxx;
+    for (const FixedEdge& e : edges) {
+      // Inside where X * 256 * DY + C >= BIAS.
+      int64_t c = (half - e.ax) * e.dy - (py - e.ay) * e.dx;
+      int64_t need = e.bias - c;
+      if (e.dy > 0)
+        lo = max(lo, ceilDiv(need, kSubpixels * e.dy));
+      else if (e.dy < 0)
+        hi = min(hi, floorDiv(-need, -kSubpixels * e.dy) + 1);
+      else if (need > 0)
+        hi = lo;
+    }
+    if (lo < hi) {
+      COUNT(stats_.pixelsCovered += hi - lo);
+      fillSpan(y, lo, hi, color);
+    }
+  }
+}
 
-PainterPtr rotate270(PainterPtr painter) {
-  return rotate90(rotate90(rotate90(painter)));
+// The sample points for antialiasing: one on each of eight
+// sub-scanlines, in eight different columns, so that near-vertical and
+// near-horizontal edges both get eight levels of coverage.
+static const int kSamplesPerPixel = 8;
+static const double kSampleColumns[kSamplesPerPixel] = {
+  5.5/8, 2.5/8, 7.5/8, 0.5/8, 3.5/8, 6.5/8, 1.5/8, 4.5/8
 };
 
-PainterPtr beside(PainterPtr a, PainterPtr b) {
-  return over(transform(a, Vector(0,0), Vector(0.5,0), Vector(0,1)),
-              transform(b, Vector(0.5,0), Vector(1,0), Vector(0.5,1)));
-};
+static Color blend(const Color& dst, const Color& src, int coverage) {
+  int keep = kSamplesPerPixel - coverage;
+  return Color((dst.r * keep + src.r * coverage + 4) / kSamplesPerPixel,
+               (dst.g * keep + src.g * coverage + 4) / kSamplesPerPixel,
+               (dst.b * keep + src.b * coverage + 4) / kSamplesPerPixel);
+}
 
-PainterPtr below(PainterPtr a, PainterPtr b) {
-  return rotate270(beside(rotate90(b), rotate90(a)));
-};
+// Like fillConvex, but counting how many of each pixel's sample points
+// are inside the polygon.  Each sub-scanline covers a run of samples
+// that is found from the edge intercepts, as in rasterizeConvex, and is
+// added to a row of coverage counts as a +1 at its start and a -1 just
+// past its end.  A running sum over the row then gives the coverage of
+// each pixel.
+template<size_t N>
+void DrawingContext::fillConvexAntialiased(const Vector (&points)[N],
+                                           const Color& color) {
+  double lox = points[0].x, hix = points[0].x;
+  double loy = points[0].y, hiy = points[0].y;
+  EdgeFunction edges[N];
+  for (size_t i = 0; i < N; i++) {
+    lox = min(lox, points[i].x); hix = max(hix, points[i].x);
+    loy = min(loy, points[i].y); hiy = max(hiy, points[i].y);
+    edges[i] = EdgeFunction(points[i], points[(i + 1) % N]);
+  }
+  uint32_t miny = floor(clamp(double(clip_.y0), loy, double(clip_.y1)));
+  uint32_t maxy = ceil(clamp(double(clip_.y0), hiy, double(clip_.y1)));
+  uint32_t minx = floor(clamp(double(clip_.x0), lox, double(clip_.x1)));
+  uint32_t maxx = ceil(clamp(double(clip_.x0), hix, double(clip_.x1)));
+  if (minx >= maxx || miny >= maxy)
+    return;
 
-PainterPtr beside3(PainterPtr a, PainterPtr b, PainterPtr c) {
-  return over
-    (transform(a, Vector(0,0), Vector(1/3.,0), Vector(0,1)),
-     over(transform(b, Vector(1/3.,0), Vector(2/3.,0), Vector(1/3.,1)),
+  COUNT(stats_.boundingBoxPixels += uint64_t(maxx - minx) * (maxy - miny));
+  // Step the edge intercepts from one sub-scanline to the next,
+  // starting afresh on each row so that the result for a row doesn't
+  // depend on where the clip rectangle starts.  Slots that no edge uses
+  // hold the sides of the bounding box, so that the loops over them
+  // have a constant trip count.
+  double step = 1.0 / kSamplesPerPixel;
+  const EdgeFunction *flat[N];
+  const EdgeFunction *leftEdges[N], *rightEdges[N];
+  double leftSlope[N], rightSlope[N];
+  size_t nflat = 0, nleft = 0, nright = 0;
+  for (const EdgeFunction& e : edges) {
+    if (e.dy > 0) {
+      leftSlope[nleft] = e.slope();
+      leftEdges[nleft++] = &e;
+    } else if (e.dy < 0) {
+      rightSlope[nright] = e.slope();
+      rightEdges[nright++] = &e;
+    } else {
+      flat[nflat++] = &e;
+    }
+  }
+  double left[N], right[N], leftStep[N], rightStep[N];
+  for (size_t i = 0; i < N; i++) {
+    left[i] = double(minx) - 1.0;
+    right[i] = double(maxx) + 1.0;
+    leftStep[i] = i < nleft ? leftSlope[i] * step : 0;
+    rightStep[i] = i < nright ? rightSlope[i] * step : 0;
+  }
+
+  coverageDeltas_.assign(maxx - minx + 1, 0);
+  int8_t *deltas = coverageDeltas_.data();
+  for (uint32_t y = miny; y < maxy; y++) {
+    double py = double(y) + step / 2;
+    for (size_t j = 0; j < nleft; j++)
+      left[j] = leftEdges[j]->ax + (py - leftEdges[j]->ay) * leftSlope[j];
+    for (size_t j = 0; j < nright; j++)
+      right[j] = rightEdges[j]->ax + (py - rightEdges[j]->ay) * rightSlope[j];
+    int64_t rowLo = maxx, rowHi = minx;
+    for (int i = 0; i < kSamplesPerPixel; i++, py += step) {
+      double xl = left[0], xr = right[0];
+      for (size_t j = 0; j < N; j++) {
+        xl = max(xl, left[j]);
+        xr = min(xr, right[j]);
+        left[j] += leftStep[j];
+        right[j] += rightStep[j];
+      }
+      bool empty = false;
+      for (size_t j = 0; j < nflat; j++)
+        empty = empty || !flat[j]->inside(flat[j]->ax, py);
+      // The first pixel whose sample on this sub-scanline is inside,
+      // and the one past the last.  Clamping to the bounding box keeps
+      // the sample positions above -2, so that adding 2 lets us floor by
+      // truncating instead of calling floor and ceil.
+      double column = kSampleColumns[i];
+      double l = min(xl, double(maxx) + 1.0) - column + 2.0;
+      double r = max(xr, double(minx) - 1.0) - column + 2.0;
+      int64_t lo = int64_t(l), hi = int64_t(r) - 1;
+      lo = max(lo - (double(lo) == l ? 2 : 1), int64_t(minx));
+      hi = min(hi, int64_t(maxx));
+      if (empty || lo >= hi)
+        continue;
+      deltas[lo - minx]++;
+      deltas[hi - minx]--;
+      rowLo = min(rowLo, lo);
+      rowHi = max(rowHi, hi);
+    }
+
+    int coverage = 0;
+    Color *out = row(y);
+    for (int64_t x = rowLo; x < rowHi; x++) {
+      coverage += deltas[x - minx];
+      deltas[x - minx] = 0;
+      if (coverage == kSamplesPerPixel)
+        out[x] = color;
+      else if (coverage > 0)
+        out[x] = blend(out[x], color, coverage);
+      COUNT(stats_.pixelsWritten += coverage > 0);
+      COUNT(stats_.pixelsCovered += coverage > 0);
+    }
+    if (rowLo < rowHi) {
+      COUNT(stats_.pixelsTested += rowHi - rowLo);
+      deltas[rowHi - minx] = 0;
+      if (coverage_)
+        memset(coverage_ + size_t(y - firstRow_) * stride_ + rowLo, 1,
+               rowHi - rowLo);
+    }
+  }
+}
+
+void DrawingContext::drawTriangle(const Vector& a, const Vector& b,
+                                  const Vector& c, const Color& color) {
+  if (backend_) {
+    backend_->drawTriangle(a, b, c, color);
+    return;
+  }
+
+  drawCanvasTriangle(canvasFrame_.project(a), canvasFrame_.project(b),
+                     canvasFrame_.project(c), color);
+}
+
+// The pixels whose centers might be within the polygon with corners
+// POINTS, within the clip rectangle.
+static PixelRect pixelBounds(const Vector* points, size_t count,
+                             const PixelRect& clip) {
+  double lox = points[0].x, hix = points[0].x;
+  double loy = points[0].y, hiy = points[0].y;
+  for (size_t i = 1; i < count; i++) {
+    lox = min(lox, points[i].x); hix = max(hix, points[i].x);
+    loy = min(loy, points[i].y); hiy = max(hiy, points[i].y);
+  }
+  return PixelRect(floor(clamp(double(clip.x0), lox, double(clip.x1))),
+                   floor(clamp(double(clip.y0), loy, double(clip.y1))),
+                   ceil(clamp(double(clip.x0), hix, double(clip.x1))),
+                   ceil(clamp(double(clip.y0), hiy, double(clip.y1))));
+}
+
+// Queue a command with the given corners in BINS, clipped to CLIP.
+static void binCommand(CommandBins& bins, CommandBins::Kind kind,
+                       const Vector* points, size_t count, const Color& color,
+                       const PixelRect& clip) {
+  PixelRect rect = pixelBounds(points, count, clip);
+  if (rect.empty())
+    return;
+  CommandBins::Command command = {};
+  command.kind = kind;
+  command.color = color;
+  for (size_t i = 0; i < count; i++) {
+    command.xs[i] = points[i].x;
+    command.ys[i] = points[i].y;
+  }
+  bins.add(command, rect);
+}
+
+void DrawingContext::drawCanvasTriangle(Vector a, Vector b, Vector c,
+                                        const Color& color) {
+  if (bins_) {
+    const Vector points[3] = { a, b, c };
+    binCommand(*bins_, CommandBins::Kind::Triangle, points, 3, color, clip_);
+    return;
+  }
+
+  if (occlusion_) {
+    const Vector points[3] = { a, b, c };
+    if (occlusion_->covers(pixelBounds(points, 3, clip_))) {
+      COUNT(stats_.occluded++);
+      return;
+    }
+  }
+
+  if (!rightOf(a, b, c))
+    std::swap(b, c);
+
+  COUNT(stats_.triangles++);
+  const Vector points[3] = { a, b, c };
+  fillConvex(points, color);
+}
+
+void DrawingContext::drawQuad(const Vector& a, const Vector &b,
+                              const Vector &c, const Vector& d,
+                              const Color& color) {
+  if (backend_) {
+    backend_->drawQuad(a, b, c, d, color);
+    return;
+  }
+
+  drawCanvasQuad(canvasFrame_.project(a), canvasFrame_.project(b),
+                 canvasFrame_.project(c), canvasFrame_.project(d), color);
+}
+
+void DrawingContext::drawCanvasQuad(const Vector& a, const Vector &b,
+                                    const Vector &c, const Vector& d,
+                                    const Color& color) {
+  if (bins_) {
+    const Vector points[4] = { a, b, c, d };
+    binCommand(*bins_, CommandBins::Kind::Quad, points, 4, color, clip_);
+    return;
+  }
+  if (occlusion_) {
+    const Vector points[4] = { a, b, c, d };
+    if (occlusion_->covers(pixelBounds(points, 4, clip_))) {
+      COUNT(stats_.occluded++);
+      return;
+    }
+  }
+
+  COUNT(stats_.quads++);
+  // Rasterize convex quads in one pass, so that there is no diagonal
+  // for the two halves to disagree about.  Other quads are split.
+  bool right = rightOf(a, b, c);
+  if (right == rightOf(b, c, d) && right == rightOf(c, d, a)
+      && right == rightOf(d, a, b)) {
+    const Vector cw[4] = { a, b, c, d };
+    const Vector ccw[4] = { a, d, c, b };
+    fillConvex(right ? cw : ccw, color);
+  } else {
+    drawCanvasTriangle(a, b, c, color);
+    drawCanvasTriangle(c, d, a, color);
+  }
+}
+    
+void DrawingContext::drawLine(const Vector& a, const Vector &b,
+                              const Color& color, double width,
+                              LineCapStyle lineCapStyle) {
+  if (backend_) {
+    const Vector points[2] = { a, b };
+    if (backend_->drawPolyline(points, 2, color, width, lineCapStyle,
+                               LineJoinStyle::None))
+      return;
+  }
+
+  Vector q = b.sub(a).normalize(width * 0.5);
+  Vector r = q.rotate90DegreesClockwise();
+    
+  switch (lineCapStyle) {
+  case LineCapStyle::Butt:
+    drawQuad(a.add(r), b.add(r), b.sub(r), a.sub(r), color);
+    break;
+  case LineCapStyle::Square:
+    drawQuad(a.sub(q).add(r), b.add(q).add(r), b.add(q).sub(r),
+             a.sub(q).sub(r),
+             color);
+    break;
+  }
+}
+
+// Fill in the outside of the corner at P, where a stroke going in
+// direction IN turns to go in direction OUT.  IN and OUT are HALFWIDTH
+// long.
+void DrawingContext::drawJoin(const Vector& p, const Vector& in,
+                              const Vector& out, double halfWidth,
+                              LineJoinStyle lineJoinStyle,
+                              const Color& color) {
+  Vector r0 = in.rotate90DegreesClockwise();
+  Vector r1 = out.rotate90DegreesClockwise();
+  // The outside of the turn is the side that OUT heads away from.
+  if (r0.x * out.x + r0.y * out.y > 0) {
+    r0 = r0.scale(-1);
+    r1 = r1.scale(-1);
+  }
+  // Going straight on, there's no corner to fill.
+  if (in.x * out.y - in.y * out.x == 0 && in.x * out.x + in.y * out.y > 0)
+    return;
+  Vector a = p.add(r0), b = p.add(r1);
+
+  switch (lineJoinStyle) {
+  case LineJoinStyle::None:
+    break;
+  case LineJoinStyle::Miter: {
+    // The point is on the bisector of R0 and R1, at HALFWIDTH divided
+    // by the cosine of half the angle between them.
+    Vector mid = r0.add(r1);
+    double midSquared = mid.x * mid.x + mid.y * mid.y;
+    const double limit = 4.0;
+    if (midSquared * limit * limit > 4 * halfWidth * halfWidth) {
+      Vector tip = p.add(mid.scale(2 * halfWidth * halfWidth / midSquared));
+      drawQuad(p, a, tip, b, color);
+      break;
+    }
+    drawTriangle(p, a, b, color);
+    break;
+  }
+  case LineJoinStyle::Bevel:
+    drawTriangle(p, a, b, color);
+    break;
+  case LineJoinStyle::Round: {
+    double start = atan2(r0.y, r0.x);
+    double sweep = atan2(r1.y, r1.x) - start;
+    if (sweep > M_PI)
+      sweep -= 2 * M_PI;
+    else if (sweep < -M_PI)
+      sweep += 2 * M_PI;
+    // Keep the arc within a quarter pixel of a true circle.  Backends
+    // without a size don't know the resolution, so they get a fine fixed
+    // step.
+    double radius = halfWidth * max(width_, height_);
+    double step = radius > 0.25 ? 2 * acos(1 - 0.25 / radius) : M_PI;
+    if (backend_ && clip_.empty())
+      step = M_PI / 32;
+    int n = min(int(ceil(fabs(sweep) / step)), 64);
+    Vector prev = a;
+    for (int i = 1; i <= n; i++) {
+      double angle = start + sweep * i / n;
+      Vector next = i == n ? b : p.add(Vector(cos(angle), sin(angle))
+                                           .scale(halfWidth));
+      drawTriangle(p, prev, next, color);
+      prev = next;
+    }
+    break;
+  }
+  }
+}
+
+void DrawingContext::drawPolyline(const Vector* points, size_t count,
+                                  const Color& color, double width,
+                                  LineCapStyle lineCapStyle,
+                                  LineJoinStyle lineJoinStyle) {
+  if (backend_ && backend_->drawPolyline(points, count, color, width,
+                                         lineCapStyle, lineJoinStyle))
+    return;
+
+  if (lineJoinStyle == LineJoinStyle::None) {
+    for (size_t i = 0; i + 1 < count; i++)
+      drawLine(points[i], points[i+1], color, width, lineCapStyle);
+    return;
+  }
+
+  // Repeated points have no direction to join at.
+  std::vector<Vector> p;
+  p.reserve(count);
+  for (size_t i = 0; i < count; i++)
+    if (p.empty() || p.back().x != points[i].x || p.back().y != points[i].y)
+      p.push_back(points[i]);
+  if (p.size() < 2)
+    return;
+
+  // A quad for each segment, with the caps on the first and last, and
+  // the corners between them filled in.
+  double halfWidth = width * 0.5;
+  Vector prevQ = Vector::zero();
+  for (size_t i = 0; i + 1 < p.size(); i++) {
+    Vector a = p[i], b = p[i+1];
+    Vector q = b.sub(a).normalize(halfWidth);
+    Vector r = q.rotate90DegreesClockwise();
+    if (i > 0)
+      drawJoin(a, prevQ, q, halfWidth, lineJoinStyle, color);
+    if (lineCapStyle == LineCapStyle::Square) {
+      if (i == 0)
+        a = a.sub(q);
+      if (i + 2 == p.size())
+        b = b.add(q);
+    }
+    drawQuad(a.add(r), b.add(r), b.sub(r), a.sub(r), color);
+    prevQ = q;
+  }
+}
+    
+// Image samplers take coordinates in pixels, with the origin at the
+// bottom left of the image, and clamp to its edges.
+struct NearestSampler
+{
+  uint32_t width, height;
+  const Color* pixels;
+
+  Color operator()(double sx, double sy) const {
+    int64_t x = clamp(int64_t(0), int64_t(floor(sx)), int64_t(width) - 1);
+    int64_t y = clamp(int64_t(0), int64_t(floor(sy)), int64_t(height) - 1);
+    return pixels[size_t(height - 1 - y) * width + x];
+  }
+};
+
+struct BilinearSampler
+{
+  uint32_t width, height;
+  const Color* pixels;
+
+  Color operator()(double sx, double sy) const {
+    sx -= 0.5;
+    sy -= 0.5;
+    double fx = floor(sx), fy = floor(sy);
+    double tx = sx - fx, ty = sy - fy;
+    int64_t x0 = clamp(int64_t(0), int64_t(fx), int64_t(width) - 1);
+    int64_t x1 = clamp(int64_t(0), int64_t(fx) + 1, int64_t(width) - 1);
+    int64_t y0 = clamp(int64_t(0), int64_t(fy), int64_t(height) - 1);
+    int64_t y1 = clamp(int64_t(0), int64_t(fy) + 1, int64_t(height) - 1);
+    const Color* r0 = pixels + size_t(height - 1 - y0) * width;
+    const Color* r1 = pixels + size_t(height - 1 - y1) * width;
+    auto mix = [&](uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+      double lo = a + (b - a) * tx, hi = c + (d - c) * tx;
+      return uint8_t(lo + (hi - lo) * ty + 0.5);
+    };
+    return Color(mix(r0[x0].r, r0[x1].r, r1[x0].r, r1[x1].r),
+                 mix(r0[x0].g, r0[x1].g, r1[x0].g, r1[x1].g),
+                 mix(r0[x0].b, r0[x1].b, r1[x0].b, r1[x1].b));
+  }
+};
+
+void DrawingContext::drawPixels(uint32_t pixelWidth, uint32_t pixelHeight,
+                                const Color* pixels, const Vector& origin,
+                                const Vector& edge1, const Vector& edge2,
+                                ImageSampling sampling) {
+  if (pixelWidth == 0 || pixelHeight == 0)
+    return;
+
+  // Backends are resolution-independent, so those that don't take images
+  // get a quad per source pixel.
+  if (backend_) {
+    if (backend_->drawPixels(pixelWidth, pixelHeight, pixels, origin, edge1,
+                             edge2, sampling))
+      return;
+    Vector dx = edge1.scale(1./pixelWidth);
+    Vector dy = edge2.scale(1./pixelHeight);
+    Vector row = origin;
+    for (uint32_t y = 0; y < pixelHeight; y++, row = row.add(dy)) {
+      Vector p = row;
+      for (uint32_t x = 0; x < pixelWidth; x++, p = p.add(dx))
+        drawQuad(p, p.add(dx), p.add(dx).add(dy), p.add(dy),
+                 pixels[(pixelHeight - y - 1) * pixelWidth + x]);
+    }
+    return;
+  }
+
+  Vector o = canvasFrame_.project(origin);
+  drawCanvasPixels(pixelWidth, pixelHeight, pixels, o,
+                   canvasFrame_.project(origin.add(edge1)).sub(o),
+                   canvasFrame_.project(origin.add(edge2)).sub(o), sampling);
+}
+
+void DrawingContext::drawCanvasPixels(uint32_t pixelWidth,
+                                      uint32_t pixelHeight,
+                                      const Color* pixels, const Vector& o,
+                                      const Vector& e1, const Vector& e2,
+                                      ImageSampling sampling) {
+  double det = e1.x * e2.y - e1.y * e2.x;
+  if (det == 0)
+    return;
+
+  if (bins_) {
+    const Vector corners[4] = { o, o.add(e1), o.add(e1).add(e2), o.add(e2) };
+    PixelRect rect = pixelBounds(corners, 4, clip_);
+    if (rect.empty())
+      return;
+    CommandBins::Command command = {};
+    command.kind = CommandBins::Kind::Image;
+    command.sampling = sampling;
+    command.pixelWidth = pixelWidth;
+    command.pixelHeight = pixelHeight;
+    command.firstPixel =
+      bins_->addPixels(pixels, size_t(pixelWidth) * pixelHeight);
+    command.xs[0] = o.x; command.ys[0] = o.y;
+    command.xs[1] = e1.x; command.ys[1] = e1.y;
+    command.xs[2] = e2.x; command.ys[2] = e2.y;
+    bins_->add(command, rect);
+    return;
+  }
+
+  COUNT(stats_.images++);
+  // For a canvas point P = O + u*E1 + v*E2, the image coordinates
+  // (u, v) are linear in P, so they can be stepped along each span.
+  double sx = pixelWidth / det, sy = pixelHeight / det;
+  double dsxdx = e2.y * sx, dsxdy = -e2.x * sx;
+  double dsydx = -e1.y * sy, dsydy = e1.x * sy;
+
+  auto shade = [&](auto sample) {
+    const Vector points[4] = { o, o.add(e1), o.add(e1).add(e2), o.add(e2) };
+    const Vector reversed[4] = { points[0], points[3], points[2], points[1] };
+    forEachSpan(det < 0 ? points : reversed,
+                [&](uint32_t y, uint32_t x0, uint32_t x1) {
+      double py = double(y) + 0.5 - o.y;
+      double u0 = py * dsxdy, v0 = py * dsydy;
+      Color* out = row(y);
+      for (uint32_t x = x0; x < x1; x++) {
+        double px = double(x) + 0.5 - o.x;
+        out[x] = sample(u0 + px * dsxdx, v0 + px * dsydx);
+      }
+      COUNT(stats_.pixelsWritten += x1 - x0);
+      if (coverage_)
+        memset(coverage_ + size_t(y - firstRow_) * stride_ + x0, 1, x1 - x0);
+    });
+  };
+
+  switch (sampling) {
+  case ImageSampling::Nearest:
+    shade(NearestSampler{pixelWidth, pixelHeight, pixels});
+    break;
+  case ImageSampling::Bilinear:
+  case ImageSampling::Mipmap:
+    shade(BilinearSampler{pixelWidth, pixelHeight, pixels});
+    break;
+  }
+}
+
+void CommandBins::reset(uint32_t width, uint32_t height) {
+  columns_ = (width + tileSize_ - 1) / tileSize_;
+  rows_ = (height + tileSize_ - 1) / tileSize_;
+  bins_.resize(size_t(columns_) * rows_);
+  for (std::vector<uint32_t>& bin : bins_)
+    bin.clear();
+  commands_.clear();
+  pixels_.clear();
+}
+
+void CommandBins::add(const Command& command, const PixelRect& rect) {
+  uint32_t index = commands_.size();
+  commands_.push_back(command);
+  for (uint32_t row = rect.y0 / tileSize_; row <= (rect.y1 - 1) / tileSize_;
+       row++)
+    for (uint32_t col = rect.x0 / tileSize_;
+         col <= (rect.x1 - 1) / tileSize_; col++)
+      bins_[size_t(row) * columns_ + col].push_back(index);
+}
+
+size_t CommandBins::addPixels(const Color* pixels, size_t count) {
+  size_t first = pixels_.size();
+  pixels_.insert(pixels_.end(), pixels, pixels + count);
+  return first;
+}
+
+void DrawingContext::setBins(CommandBins* bins) {
+  flush();
+  bins_ = bins;
+  if (bins_)
+    bins_->reset(width_, height_);
+}
+
+bool DrawingContext::writePPM(const char *fname) {
+  flush();
+  if (backend_) {
+    fprintf(stderr, "can't write %s: the context has no pixels\n", fname);
+    return false;
+  }
+  FILE *f = fopen(fname, "w");
+  if (!f) {
+    fprintf(stderr, "failed to create %s: ", fname);
+    perror(NULL);
+    return false;
+  }
+  uint32_t w = clip_.empty() ? 0 : clip_.x1 - clip_.x0;
+  uint32_t h = clip_.empty() ? 0 : clip_.y1 - clip_.y0;
+  fprintf(f, "P6\n%u %u\n255\n", w, h);
+  // Color is packed RGB, so the pixels are already in PPM order.
+  bool ok = true;
+  for (uint32_t y = clip_.y0; ok && y < clip_.y0 + h; y++)
+    ok = fwrite(row(y) + clip_.x0, sizeof(Color), w, f) == w;
+  if (!ok || fflush(f) != 0) {
+    perror("writing PPM file failed"); 
+    fclose(f);
+    return false;
+  }
+  if (fclose(f) != 0) {
+    perror("writing PPM file failed"); 
+    return false;
+  }
+  return true;
+}
+  
+std::vector<Color> DrawingContext::getPixels() {
+  flush();
+  // Contexts that store their own pixels store just the clip rectangle.
+  if (pixels_ == storage_.data())
+    return storage_;
+  if (backend_ || clip_.empty())
+    return std::vector<Color>();
+  uint32_t w = clip_.x1 - clip_.x0;
+  std::vector<Color> ret;
+  ret.reserve(size_t(w) * (clip_.y1 - clip_.y0));
+  for (uint32_t y = clip_.y0; y < clip_.y1; y++)
+    ret.insert(ret.end(), row(y) + clip_.x0, row(y) + clip_.x1);
+  return ret;
+}
+
+const std::vector<uint8_t>& DrawingContext::getRGBA() {
+  flush();
+  rgba_.clear();
+  if (backend_ || clip_.empty())
+    return rgba_;
+  rgba_.resize(size_t(clip_.x1 - clip_.x0) * (clip_.y1 - clip_.y0) * 4);
+  uint8_t *out = rgba_.data();
+  for (uint32_t y = clip_.y0; y < clip_.y1; y++) {
+    for (const Color *c = row(y) + clip_.x0; c < row(y) + clip_.x1; c++) {
+      out[0] = c->r;
+      out[1] = c->g;
+      out[2] = c->b;
+      out[3] = 255;
+      out += 4;
+    }
+  }
+  return rgba_;
+}
+
+int64_t RenderTrace::now() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RenderTrace::end(const char *name, int64_t start) {
+  depth_--;
+  events_.push_back(Event{name, thread_, depth_, start, now() - start});
+}
+
+void RenderTrace::append(const RenderTrace& other) {
+  events_.insert(events_.end(), other.events_.begin(), other.events_.end());
+}
+
+std::string RenderTrace::toJSON() const {
+  int64_t epoch = 0;
+  for (size_t i = 0; i < events_.size(); i++)
+    epoch = i ? min(epoch, events_[i].start) : events_[i].start;
+  // Complete events, with times in microseconds.
+  std::string ret = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+  char buf[256];
+  for (size_t i = 0; i < events_.size(); i++) {
+    const Event& e = events_[i];
+    snprintf(buf, sizeof(buf),
+             "%s\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u,"
+             " \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"depth\": %u}}",
+             i ? "," : "", e.name, e.thread, (e.start - epoch) / 1e3,
+             e.duration / 1e3, e.depth);
+    ret += buf;
+  }
+  ret += "\n]}\n";
+  return ret;
+}
+
+bool RenderTrace::write(const char *fname) const {
+  FILE *f = fopen(fname, "w");
+  if (!f) {
+    fprintf(stderr, "failed to create %s: ", fname);
+    perror(NULL);
+    return false;
+  }
+  std::string json = toJSON();
+  if (fwrite(json.data(), 1, json.size(), f) != json.size()
+      || fflush(f) != 0) {
+    perror("writing trace failed");
+    fclose(f);
+    return false;
+  }
+  if (fclose(f) != 0) {
+    perror("writing trace failed");
+    return false;
+  }
+  return true;
+}
+
+// IEEE half-precision floats, rounded to nearest even.
+static uint16_t toHalf(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t biased = (x >> 23) & 0xff;
+  uint32_t mantissa = x & 0x7fffff;
+  if (biased == 0xff)
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  int32_t exponent = int32_t(biased) - 127 + 15;
+  if (exponent >= 31)
+    return sign | 0x7c00;
+  uint32_t shift = 13;
+  if (exponent <= 0) {
+    // Subnormal, with the implicit leading bit made explicit.
+    if (exponent < -10)
+      return sign;
+    mantissa |= 0x800000;
+    shift = 14 - exponent;
+    exponent = 0;
+  }
+  uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> shift);
+  uint32_t rest = mantissa & ((1u << shift) - 1), midpoint = 1u << (shift - 1);
+  // Rounding up can carry into the exponent, which is still right.
+  if (rest > midpoint || (rest == midpoint && (half & 1)))
+    half++;
+  return sign | half;
+}
+
+static float fromHalf(uint16_t h) {
+  uint32_t sign = uint32_t(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f, mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    float f = ldexpf(float(mantissa), -24);
+    return sign ? -f : f;
+  }
+  uint32_t x = sign | (mantissa << 13)
+    | (exponent == 31 ? 0x7f800000 : (exponent + 112) << 23);
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+// Surface pixels as premultiplied floats, and back.
+struct PremultipliedColor
+{
+  float r, g, b, a;
+};
+
+static PremultipliedColor load(const RGBA8& p) {
+  return { p.r / 255.f, p.g / 255.f, p.b / 255.f, p.a / 255.f };
+}
+static PremultipliedColor load(const RGBA16F& p) {
+  return { fromHalf(p.r), fromHalf(p.g), fromHalf(p.b), fromHalf(p.a) };
+}
+static PremultipliedColor load(const RGBAF32& p) {
+  return { p.r, p.g, p.b, p.a };
+}
+
+static uint8_t toByte(float x) {
+  return uint8_t(clamp(0.f, x, 1.f) * 255.f + 0.5f);
+}
+
+static void store(const PremultipliedColor& c, RGBA8& out) {
+  out = RGBA8{ toByte(c.r), toByte(c.g), toByte(c.b), toByte(c.a) };
+}
+static void store(const PremultipliedColor& c, RGBA16F& out) {
+  out = RGBA16F{ toHalf(c.r), toHalf(c.g), toHalf(c.b), toHalf(c.a) };
+}
+static void store(const PremultipliedColor& c, RGBAF32& out) {
+  out = RGBAF32{ c.r, c.g, c.b, c.a };
+}
+
+template<typename Pixel>
+Surface<Pixel>::Surface(uint32_t width, uint32_t height)
+  : width_(width), height_(height), pixels_(size_t(width) * height) {
+  for (Pixel& p : pixels_)
+    store(PremultipliedColor{0, 0, 0, 0}, p);
+}
+
+// Blend the N pixels of SRC over DST at opacity ALPHA, from 0 to 1.
+template<typename Pixel>
+static void compositeRow(Pixel* dst, const Color* src, size_t n,
+                         double alpha, std::vector<RGBA8>& scratch) {
+  float a = alpha, keep = 1.f - a, scale = a / 255.f;
+  for (size_t i = 0; i < n; i++) {
+    PremultipliedColor d = load(dst[i]);
+    store(PremultipliedColor{ src[i].r * scale + d.r * keep,
+                              src[i].g * scale + d.g * keep,
+                              src[i].b * scale + d.b * keep,
+                              a + d.a * keep }, dst[i]);
+  }
+}
+
+// As the weight is the same for every channel, RGBA8 can use the byte
+// blending kernels, once SRC has an alpha channel.
+static void compositeRow(RGBA8* dst, const Color* src, size_t n,
+                         double alpha, std::vector<RGBA8>& scratch) {
+  uint32_t weight = uint32_t(alpha * 256 + 0.5);
+  if (weight == 0)
+    return;
+  scratch.resize(n);
+  for (size_t i = 0; i < n; i++)
+    scratch[i] = RGBA8{ src[i].r, src[i].g, src[i].b, 255 };
+  blendBytes(reinterpret_cast<uint8_t*>(dst),
+             reinterpret_cast<const uint8_t*>(scratch.data()),
+             n * sizeof(RGBA8), weight);
+}
+
+template<typename Pixel>
+bool Surface<Pixel>::composite(DrawingContext& cx, double alpha) {
+  if (cx.width_ != width_ || cx.height_ != height_) {
+    fprintf(stderr, "can't composite a %ux%u context onto a %ux%u surface\n",
+            cx.width_, cx.height_, width_, height_);
+    return false;
+  }
+  cx.flush();
+  const PixelRect& clip = cx.clip_;
+  if (cx.backend_ || clip.empty())
+    return true;
+  std::vector<RGBA8> scratch;
+  for (uint32_t y = clip.y0; y < clip.y1; y++)
+    compositeRow(&pixels_[size_t(y) * width_ + clip.x0], cx.row(y) + clip.x0,
+                 clip.x1 - clip.x0, clamp(0.0, alpha, 1.0), scratch);
+  return true;
+}
+
+template<typename Pixel>
+std::vector<Color> Surface<Pixel>::flatten(const Color& background) const {
+  std::vector<Color> ret(pixels_.size());
+  float r = background.r / 255.f;
+  float g = background.g / 255.f;
+  float b = background.b / 255.f;
+  for (size_t i = 0; i < pixels_.size(); i++) {
+    PremultipliedColor c = load(pixels_[i]);
+    float keep = 1.f - c.a;
+    ret[i] = Color(toByte(c.r + r * keep), toByte(c.g + g * keep),
+                   toByte(c.b + b * keep));
+  }
+  return ret;
+}
+
+template<typename Pixel>
+bool Surface<Pixel>::writePFM(const char *fname) const {
+  FILE *f = fopen(fname, "w");
+  if (!f) {
+    fprintf(stderr, "failed to create %s: ", fname);
+    perror(NULL);
+    return false;
+  }
+  // A negative scale means little-endian, and rows go from the bottom.
+  fprintf(f, "PF\n%u %u\n-1.0\n", width_, height_);
+  std::vector<float> row(size_t(width_) * 3);
+  bool ok = true;
+  for (uint32_t y = height_; ok && y-- > 0;) {
+    for (uint32_t x = 0; x < width_; x++) {
+      PremultipliedColor c = load(pixels_[size_t(y) * width_ + x]);
+      row[x * 3] = c.r;
+      row[x * 3 + 1] = c.g;
+      row[x * 3 + 2] = c.b;
+    }
+    ok = fwrite(row.data(), sizeof(float), row.size(), f) == row.size();
+  }
+  if (!ok || fflush(f) != 0) {
+    perror("writing PFM file failed");
+    fclose(f);
+    return false;
+  }
+  if (fclose(f) != 0) {
+    perror("writing PFM file failed");
+    return false;
+  }
+  return true;
+}
+
+template class Surface<RGBA8>;
+template class Surface<RGBA16F>;
+template class Surface<RGBAF32>;
+
+void DisplayList::drawTriangle(const Vector& a, const Vector& b,
+                               const Vector& c, const Color& color) {
+  for (const Vector& v : { a, b, c }) {
+    xs_.push_back(v.x);
+    ys_.push_back(v.y);
+  }
+  sides_.push_back(3);
+  colors_.push_back(color);
+}
+
+void DisplayList::drawQuad(const Vector& a, const Vector& b, const Vector& c,
+                           const Vector& d, const Color& color) {
+  for (const Vector& v : { a, b, c, d }) {
+    xs_.push_back(v.x);
+    ys_.push_back(v.y);
+  }
+  sides_.push_back(4);
+  colors_.push_back(color);
+}
+
+void DisplayList::beginOpacity(double alpha) {
+  sides_.push_back(BeginOpacity);
+  colors_.push_back(Color());
+  alphas_.push_back(alpha);
+}
+
+void DisplayList::endOpacity() {
+  sides_.push_back(EndOpacity);
+  colors_.push_back(Color());
+}
+
+// A translucent group of a display list as a Painter, for
+// paintTranslucent.
+class DisplayListGroup : public Painter
+{
+private:
+  const DisplayList& list_;
+  const DisplayList::Cursor start_;
+  const Bounds bounds_;
+
+public:
+  DisplayListGroup(const DisplayList& list,
+                   const DisplayList::Cursor& start, const Bounds& bounds)
+    : list_(list), start_(start), bounds_(bounds) {}
+
+  void paint(DrawingContext& cx, const Frame& frame) const {
+    DisplayList::Cursor at = start_;
+    list_.replayGroup(cx, at);
+  }
+  Bounds bounds() const { return bounds_; }
+};
+
+void DisplayList::skipGroup(Cursor& at) const {
+  for (size_t depth = 1; depth; at.entry++) {
+    switch (sides_[at.entry]) {
+    case BeginOpacity:
+      depth++;
+      at.alpha++;
+      break;
+    case EndOpacity:
+      depth--;
+      break;
+    default:
+      at.vertex += sides_[at.entry];
+    }
+  }
+}
+
+void DisplayList::replayGroup(DrawingContext& cx, Cursor& at) const {
+  while (at.entry < sides_.size()) {
+    uint8_t sides = sides_[at.entry];
+    const double *x = xs_.data() + at.vertex, *y = ys_.data() + at.vertex;
+    if (sides == EndOpacity) {
+      at.entry++;
+      return;
+    }
+    if (sides == BeginOpacity) {
+      double alpha = alphas_[at.alpha];
+      Cursor start = at;
+      start.entry++;
+      start.alpha++;
+      at = start;
+      skipGroup(at);
+      // The group's vertices are those between its start and its end.
+      size_t count = at.vertex - start.vertex;
+      if (count) {
+        Vector lo(x[0], y[0]), hi(x[0], y[0]);
+        for (size_t i = 1; i < count; i++) {
+          lo = Vector(::min(lo.x, x[i]), ::min(lo.y, y[i]));
+          hi = Vector(::max(hi.x, x[i]), ::max(hi.y, y[i]));
+        }
+        cx.paintTranslucent(DisplayListGroup(*this, start, Bounds(lo, hi)),
+                            Frame(Vector(0,0), Vector(1,0), Vector(0,1)),
+                            alpha);
+      }
+      continue;
+    }
+    if (sides == 3) {
+      cx.drawTriangle(Vector(x[0], y[0]), Vector(x[1], y[1]),
+                      Vector(x[2], y[2]), colors_[at.entry]);
+    } else {
+      cx.drawQuad(Vector(x[0], y[0]), Vector(x[1], y[1]),
+                  Vector(x[2], y[2]), Vector(x[3], y[3]), colors_[at.entry]);
+    }
+    at.vertex += sides;
+    at.entry++;
+  }
+}
+
+void DisplayList::replay(DrawingContext& cx) const {
+  Cursor at;
+  replayGroup(cx, at);
+}
+
+bool DisplayList::drawFrontToBack(DrawingContext& cx,
+                                  const Color* background) const {
+  if (cx.antialias_ || cx.backend_ || cx.bins_ || cx.occlusion_
+      || !alphas_.empty())
+    return false;
+  if (cx.clip_.empty())
+    return true;
+
+  OcclusionMask mask(cx.clip_);
+  cx.occlusion_ = &mask;
+  const double *x = xs_.data() + xs_.size(), *y = ys_.data() + ys_.size();
+  for (size_t i = sides_.size(); i-- > 0; ) {
+    x -= sides_[i];
+    y -= sides_[i];
+    if (sides_[i] == 3) {
+      cx.drawTriangle(Vector(x[0], y[0]), Vector(x[1], y[1]),
+                      Vector(x[2], y[2]), colors_[i]);
+    } else {
+      cx.drawQuad(Vector(x[0], y[0]), Vector(x[1], y[1]),
+                  Vector(x[2], y[2]), Vector(x[3], y[3]), colors_[i]);
+    }
+  }
+  if (background)
+    cx.fill(*background);
+  cx.occlusion_ = nullptr;
+  return true;
+}
+
+void DisplayList::replayFrontToBack(DrawingContext& cx) const {
+  if (!drawFrontToBack(cx, nullptr))
+    replay(cx);
+}
+
+void DisplayList::paint(DrawingContext& cx) const {
+  cx.fill(Color::white());
+  replay(cx);
+}
+
+void DisplayList::paintFrontToBack(DrawingContext& cx) const {
+  Color background = Color::white();
+  if (!drawFrontToBack(cx, &background))
+    paint(cx);
+}
+
+// Append " NAME="#rrggbb"" to OUT.
+static void appendColor(std::string& out, const char* name,
+                        const Color& color) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), " %s=\"#%02x%02x%02x\"", name, color.r, color.g,
+           color.b);
+  out += buf;
+}
+
+// Append the coordinates of P to OUT, with SEPARATOR between them.
+// Seven digits keep vertices well within a pixel on canvases up to a
+// million pixels on a side.
+static void appendPoint(std::string& out, const Vector& p,
+                        char separator) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.7g%c%.7g", p.x, separator, p.y);
+  out += buf;
+}
+
+static void appendPolygon(std::string& out, const Vector* points,
+                          size_t count, const Color& color) {
+  out += "<polygon points=\"";
+  for (size_t i = 0; i < count; i++) {
+    if (i)
+      out += ' ';
+    appendPoint(out, points[i], ',');
+  }
+  out += '"';
+  appendColor(out, "fill", color);
+  out += "/>\n";
+}
+
+void SVGBackend::fill(const Color& color) {
+  if (depth_ == 0)
+    body_.clear();
+  body_ += "<rect width=\"1\" height=\"1\"";
+  appendColor(body_, "fill", color);
+  body_ += "/>\n";
+}
+
+void SVGBackend::drawTriangle(const Vector& a, const Vector& b,
+                              const Vector& c, const Color& color) {
+  const Vector points[3] = { a, b, c };
+  appendPolygon(body_, points, 3, color);
+}
+
+void SVGBackend::drawQuad(const Vector& a, const Vector& b, const Vector& c,
+                          const Vector& d, const Color& color) {
+  const Vector points[4] = { a, b, c, d };
+  appendPolygon(body_, points, 4, color);
+}
+
+bool SVGBackend::drawPolyline(const Vector* points, size_t count,
+                              const Color& color, double width,
+                              LineCapStyle lineCapStyle,
+                              LineJoinStyle lineJoinStyle) {
+  // As when rasterizing, repeated points draw nothing: separate lines
+  // are each a subpath of their own, and joined strokes skip them.
+  std::string d;
+  bool joined = lineJoinStyle != LineJoinStyle::None;
+  size_t last = 0;
+  for (size_t i = 1; i < count; i++) {
+    const Vector& a = points[joined ? last : i - 1];
+    const Vector& b = points[i];
+    if (a.x == b.x && a.y == b.y)
+      continue;
+    if (d.empty() || !joined) {
+      d += d.empty() ? "M" : " M";
+      appendPoint(d, a, ' ');
+    }
+    d += " L";
+    appendPoint(d, b, ' ');
+    last = i;
+  }
+  if (d.empty())
+    return true;
+
+  body_ += "<path d=\"" + d + "\" fill=\"none\"";
+  appendColor(body_, "stroke", color);
+  char buf[64];
+  snprintf(buf, sizeof(buf), " stroke-width=\"%.7g\"", width);
+  body_ += buf;
+  if (lineCapStyle == LineCapStyle::Square)
+    body_ += " stroke-linecap=\"square\"";
+  // SVG's default miter limit of 4 is the one drawJoin uses.
+  if (lineJoinStyle == LineJoinStyle::Bevel)
+    body_ += " stroke-linejoin=\"bevel\"";
+  else if (lineJoinStyle == LineJoinStyle::Round)
+    body_ += " stroke-linejoin=\"round\"";
+  body_ += "/>\n";
+  return true;
+}
+
+void SVGBackend::beginOpacity(double alpha) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "<g opacity=\"%.4g\">\n", alpha);
+  body_ += buf;
+  depth_++;
+}
+
+void SVGBackend::endOpacity() {
+  body_ += "</g>\n";
+  depth_--;
+}
+
+std::string SVGBackend::toSVG() const {
+  // The picture is drawn in the unit square with y going up, so flip it
+  // and scale it to the canvas.  Strokes scale with it, as they do when
+  // rasterizing.
+  char buf[512];
+  snprintf(buf, sizeof(buf),
+           "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%u\""
+           " height=\"%u\" viewBox=\"0 0 %u %u\">\n"
+           "<g transform=\"matrix(%u 0 0 -%u 0 %u)\">\n",
+           width_, height_, width_, height_, width_, height_, height_);
+  return buf + body_ + "</g>\n</svg>\n";
+}
+
+bool SVGBackend::write(const char *fname) const {
+  FILE *f = fopen(fname, "w");
+  if (!f) {
+    fprintf(stderr, "failed to create %s: ", fname);
+    perror(NULL);
+    return false;
+  }
+  std::string svg = toSVG();
+  if (fwrite(svg.data(), 1, svg.size(), f) != svg.size()
+      || fflush(f) != 0) {
+    perror("writing SVG file failed");
+    fclose(f);
+    return false;
+  }
+  if (fclose(f) != 0) {
+    perror("writing SVG file failed");
+    return false;
+  }
+  return true;
+}
+
+bool RenderCache::Key::operator<(const Key& other) const {
+  if (painter != other.painter)
+    return painter < other.painter;
+  if (width != other.width)
+    return width < other.width;
+  if (height != other.height)
+    return height < other.height;
+  if (canvasWidth != other.canvasWidth)
+    return canvasWidth < other.canvasWidth;
+  return canvasHeight < other.canvasHeight;
+}
+
+size_t RenderCache::bytes() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return bytes_;
+}
+
+size_t RenderCache::hits() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return hits_;
+}
+
+size_t RenderCache::misses() const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return misses_;
+}
+
+void RenderCache::clear() {
+  std::lock_guard<std::mutex> guard(lock_);
+  entries_.clear();
+  bytes_ = hits_ = misses_ = 0;
+}
+
+static size_t textureBytes(uint32_t width, uint32_t height) {
+  return size_t(width) * height * (sizeof(Color) + 1);
+}
+
+RenderCache::TexturePtr
+RenderCache::lookup(const std::shared_ptr<const Painter>& painter,
+                    uint32_t width, uint32_t height,
+                    uint32_t canvasWidth, uint32_t canvasHeight) {
+  std::lock_guard<std::mutex> guard(lock_);
+  auto it = entries_.find(Key{painter.get(), width, height,
+                              canvasWidth, canvasHeight});
+  if (it == entries_.end()) {
+    misses_++;
+    return nullptr;
+  }
+  hits_++;
+  return it->second.texture;
+}
+
+bool RenderCache::wouldFit(uint32_t width, uint32_t height) const {
+  std::lock_guard<std::mutex> guard(lock_);
+  return bytes_ + textureBytes(width, height) <= maxBytes_;
+}
+
+void RenderCache::insert(const std::shared_ptr<const Painter>& painter,
+                         uint32_t canvasWidth, uint32_t canvasHeight,
+                         TexturePtr texture) {
+  std::lock_guard<std::mutex> guard(lock_);
+  size_t size = textureBytes(texture->width, texture->height);
+  if (bytes_ + size > maxBytes_)
+    return;
+  Key key{painter.get(), texture->frameWidth, texture->frameHeight,
+          canvasWidth, canvasHeight};
+  // Another thread may have rendered the same texture meanwhile.
+  if (entries_.emplace(key, Entry{painter, texture}).second)
+    bytes_ += size;
+}
+
+// If X is within a small tolerance of an integer, store that integer in
+// OUT.
+static bool nearInteger(double x, int64_t& out) {
+  double r = round(x);
+  if (fabs(x - r) > 1e-6)
+    return false;
+  out = int64_t(r);
+  return true;
+}
+
+bool DrawingContext::paintCached(const PainterPtr& painter,
+                                 const Frame& frame) {
+  // Only painters with several parents are likely to be painted again.
+  if (!cache_ || backend_ || bins_ || antialias_ || painter.use_count() < 2)
+    return false;
+
+  // The frame, in pixels, has to be a rotation or flip of a rectangle
+  // whose corners are on pixel boundaries.
+  Frame f = canvasFrame_.project(frame);
+  int64_t ox, oy, e1x, e1y, e2x, e2y;
+  if (!nearInteger(f.origin.x, ox) || !nearInteger(f.origin.y, oy)
+      || !nearInteger(f.edge1.x, e1x) || !nearInteger(f.edge1.y, e1y)
+      || !nearInteger(f.edge2.x, e2x) || !nearInteger(f.edge2.y, e2y))
+    return false;
+  int64_t w, h;
+  if (e1y == 0 && e2x == 0) {
+    w = llabs(e1x); h = llabs(e2y);
+  } else if (e1x == 0 && e2y == 0) {
+    w = llabs(e1y); h = llabs(e2x);
+  } else {
+    return false;
+  }
+  // Tiny textures aren't worth it.
+  if (w * h < 256)
+    return false;
+
+  RenderCache::TexturePtr texture =
+    cache_->lookup(painter, w, h, width_, height_);
+  if (!texture) {
+    // Leave a margin for anything painted outside the frame, such as
+    // the ends of lines along its edges.
+    Bounds b = painter->bounds();
+    if (b.isUnbounded())
+      return false;
+    double pad = b.pad * max(width_, height_) + 1.0;
+    int64_t left = ceil(max(0.0, -b.min.x) * w + pad);
+    int64_t right = ceil(max(0.0, b.max.x - 1) * w + pad);
+    int64_t bottom = ceil(max(0.0, -b.min.y) * h + pad);
+    int64_t top = ceil(max(0.0, b.max.y - 1) * h + pad);
+    int64_t tw = left + w + right, th = bottom + h + top;
+    // The texture has to fit in the bottom-left corner of the canvas.
+    if (tw > width_ || th > height_ || !cache_->wouldFit(tw, th))
+      return false;
+    auto fresh = std::make_shared<RenderCache::Texture>(w, h, left, bottom,
+                                                        tw, th);
+    DrawingContext cx(*this, PixelRect(0, height_ - th, tw, height_), tw,
+                      fresh->pixels.data(), fresh->coverage.data());
+    painter->paint(cx, Frame(Vector(double(left) / width_,
+                                    double(bottom) / height_),
+                             Vector(double(w) / width_, 0),
+                             Vector(0, double(h) / height_)));
+    stats_.add(cx.stats());
+    // Translucent painters blend with what is below them, which the
+    // texture doesn't have, so paint directly instead.
+    if (cx.translucent_)
+      return false;
+    cache_->insert(painter, width_, height_, fresh);
+    texture = fresh;
+  }
+
+  // Texture pixel (i, j) has its center at (u, v) in the painter's unit
+  // space; find the canvas pixel whose center that maps to.
+  const RenderCache::Texture& t = *texture;
+  auto target = [&](uint32_t i, uint32_t j, int64_t& x, int64_t& y) {
+    Vector p = f.project(Vector((i + 0.5 - t.marginX) / w,
+                                (t.height - t.marginY - j - 0.5) / h));
+    x = int64_t(floor(p.x));
+    y = int64_t(floor(p.y));
+  };
+  int64_t x00, y00, x10, y10, x01, y01;
+  target(0, 0, x00, y00);
+  target(1, 0, x10, y10);
+  target(0, 1, x01, y01);
+  for (uint32_t j = 0; j < t.height; j++) {
+    const Color *src = &t.pixels[size_t(j) * t.width];
+    const uint8_t *covered = &t.coverage[size_t(j) * t.width];
+    for (uint32_t i = 0; i < t.width; i++) {
+      if (!covered[i])
+        continue;
+      int64_t x = x00 + i * (x10 - x00) + j * (x01 - x00);
+      int64_t y = y00 + i * (y10 - y00) + j * (y01 - y00);
+      if (x < clip_.x0 || x >= clip_.x1 || y < clip_.y0 || y >= clip_.y1)
+        continue;
+      row(y)[x] = src[i];
+      COUNT(stats_.pixelsWritten++);
+      if (coverage_)
+        coverage_[size_t(y - firstRow_) * stride_ + x] = 1;
+    }
+  }
+  return true;
+}
+
+// Counts a call to Painter::paint, and records it in the context's
+// trace while in scope, if there is one.
+class PaintScope
+{
+#ifndef PICTIE_NO_STATS
+private:
+  RenderTrace *trace_;
+  const char *name_;
+  int64_t start_;
+
+public:
+  PaintScope(DrawingContext& cx, const char *name)
+    : trace_(cx.trace()), name_(name), start_(trace_ ? trace_->begin() : 0) {
+    cx.stats().painters++;
+  }
+  ~PaintScope() {
+    if (trace_)
+      trace_->end(name_, start_);
+  }
+#else
+public:
+  PaintScope(DrawingContext&, const char *) {}
+#endif
+  PaintScope(const PaintScope&) = delete;
+  PaintScope& operator=(const PaintScope&) = delete;
+};
+
+void DrawingContext::paintTranslucent(const Painter& painter,
+                                      const Frame& frame, double alpha) {
+  uint32_t weight = uint32_t(clamp(0.0, alpha, 1.0) * 256 + 0.5);
+  if (backend_ && weight != 0 && weight != 256) {
+    backend_->beginOpacity(clamp(0.0, alpha, 1.0));
+    painter.paint(*this, frame);
+    backend_->endOpacity();
+    return;
+  }
+  if (weight == 256) {
+    painter.paint(*this, frame);
+    return;
+  }
+  if (weight == 0 || clip_.empty())
+    return;
+  flush();
+
+  // The layer only needs to cover what the painter might paint.
+  PixelRect rect = clipBounds(painter.bounds(), frame);
+  if (rect.empty())
+    return;
+
+  // Start the layer as a copy of what is below, so that antialiased
+  // edges blend with it, and pixels that the painter doesn't touch
+  // blend back to what they were.
+  uint32_t w = rect.x1 - rect.x0;
+  std::vector<Color> pixels(size_t(rect.x1) * (rect.y1 - rect.y0));
+  for (uint32_t y = rect.y0; y < rect.y1; y++)
+    memcpy(&pixels[size_t(y - rect.y0) * rect.x1 + rect.x0],
+           row(y) + rect.x0, w * sizeof(Color));
+  DrawingContext layer(*this, rect, rect.x1, pixels.data(), nullptr);
+  painter.paint(layer, frame);
+  stats_.add(layer.stats());
+  translucent_ = true;
+
+  for (uint32_t y = rect.y0; y < rect.y1; y++)
+    blendBytes(reinterpret_cast<uint8_t*>(row(y) + rect.x0),
+               reinterpret_cast<const uint8_t*>(
+                 &pixels[size_t(y - rect.y0) * rect.x1 + rect.x0]),
+               w * sizeof(Color), weight);
+  COUNT(stats_.pixelsWritten += uint64_t(w) * (rect.y1 - rect.y0));
+}
+
+class TrianglePainter : public Painter
+{
+private:
+  const Vector a_;
+  const Vector b_;
+  const Vector c_;
+  const Color color_;
+
+public:
+  explicit TrianglePainter(const Vector& a, const Vector& b,
+                           const Vector& c, const Color& color)
+    : a_(a), b_(b), c_(c), color_(color) {}
+
+  void paint(DrawingContext &cx, const Frame& frame) const {
+    PaintScope scope(cx, "triangle");
+    cx.drawTriangle(frame.project(a_), frame.project(b_),
+                    frame.project(c_), color_);
+  }
+
+  Bounds bounds() const { return Bounds::of({a_, b_, c_}); }
+
+  const Vector& a() const { return a_; }
+  const Vector& b() const { return b_; }
+  const Vector& c() const { return c_; }
+  const Color& color() const { return color_; }
+};
+
+class ParallelogramPainter : public Painter
+{
+private:
+  const Vector origin_;
+  const Vector edge1_;
+  const Vector edge2_;
+  const Color color_;
+
+public:
+  explicit ParallelogramPainter(const Vector& origin, const Vector& edge1,
+                                const Vector& edge2, const Color& color)
+    : origin_(origin), edge1_(edge1), edge2_(edge2), color_(color) {}
+
+  void paint(DrawingContext &cx, const Frame& frame) const {
+    PaintScope scope(cx, "parallelogram");
+    // One quad rather than two triangles, so that antialiasing does not
+    // blend the diagonal twice.
+    cx.drawQuad(frame.project(origin_), frame.project(origin_.add(edge1_)),
+                frame.project(origin_.add(edge1_).add(edge2_)),
+                frame.project(origin_.add(edge2_)), color_);
+  }
+
+  Bounds bounds() const {
+    return Bounds::of({origin_, origin_.add(edge1_),
+                       origin_.add(edge1_).add(edge2_),
+                       origin_.add(edge2_)});
+  }
+
+  const Vector& origin() const { return origin_; }
+  const Vector& edge1() const { return edge1_; }
+  const Vector& edge2() const { return edge2_; }
+  const Color& color() const { return color_; }
+};
+                      
+static double strokeWidth(const Frame& frame, double width,
+                          LineWidthScaling widthScaling) {
+  switch (widthScaling) {
+  case LineWidthScaling::Scaled: {
+    double diagonal = frame.edge1.add(frame.edge2).magnitude();
+    double unitDiagonal = Vector(1,1).magnitude();
+    return width * diagonal / unitDiagonal;
+  }
+  case LineWidthScaling::Unscaled:
+    return width;
+  default:
+    abort();
+  }
+}
+
+static void paintPath(DrawingContext &cx, const Frame& frame,
+                      const Vector* points, size_t count, const Color& color,
+                      double width, LineCapStyle lineCapStyle,
+                      LineWidthScaling widthScaling,
+                      LineJoinStyle lineJoinStyle) {
+  width = strokeWidth(frame, width, widthScaling);
+  if (lineJoinStyle == LineJoinStyle::None) {
+    for (size_t i = 0; i + 1 < count; i++)
+      cx.drawLine(frame.project(points[i]), frame.project(points[i+1]),
+                  color, width, lineCapStyle);
+    return;
+  }
+  // The width applies after projection, so the stroke has to be
+  // tessellated in canvas space.
+  std::vector<Vector> projected;
+  projected.reserve(count);
+  for (size_t i = 0; i < count; i++)
+    projected.push_back(frame.project(points[i]));
+  cx.drawPolyline(projected.data(), count, color, width, lineCapStyle,
+                  lineJoinStyle);
+}
+
+static void paintSegments(DrawingContext &cx, const Frame& frame,
+                          const Vector* endpoints, size_t count,
+                          const Color& color, double width,
+                          LineCapStyle lineCapStyle,
+                          LineWidthScaling widthScaling) {
+  width = strokeWidth(frame, width, widthScaling);
+  for (size_t i = 0; i + 1 < count; i += 2)
+    cx.drawLine(frame.project(endpoints[i]), frame.project(endpoints[i+1]),
+                color, width, lineCapStyle);
+}
+
+static Bounds pathBounds(const Vector* points, size_t count, double width,
+                         LineWidthScaling widthScaling,
+                         LineJoinStyle lineJoinStyle) {
+  // Scaled widths depend on the frame, so we can't bound them here.
+  if (widthScaling == LineWidthScaling::Scaled)
+    return Bounds::unbounded();
+  // Miter tips can be up to four half-widths from their corners.
+  if (lineJoinStyle == LineJoinStyle::Miter)
+    return Bounds::of(points, count, width * 2);
+  // With square caps, the corners are sqrt(2)/2 widths from the ends,
+  // which is also as far as bevels and round joins reach.
+  return Bounds::of(points, count, width * 0.75);
+}
+
+class PathPainter : public Painter
+{
+private:
+  std::vector<Vector> points_;
+  const Color color_;
+  double width_;
+  LineCapStyle lineCapStyle_;
+  LineWidthScaling widthScaling_;
+  LineJoinStyle lineJoinStyle_;
+
+public:
+  PathPainter(const std::vector<Vector>& points, const Color& color,
+              double width = 1.0,
+              LineCapStyle lineCapStyle = LineCapStyle::Butt,
+              LineWidthScaling widthScaling = LineWidthScaling::Unscaled,
+              LineJoinStyle lineJoinStyle = LineJoinStyle::None)
+    : points_(points), color_(color), width_(width),
+      lineCapStyle_(lineCapStyle), widthScaling_(widthScaling),
+      lineJoinStyle_(lineJoinStyle) {}
+
+  void paint(DrawingContext &cx, const Frame& frame) const {
+    PaintScope scope(cx, "path");
+    if (cx.culls(bounds(), frame))
+      return;
+    paintPath(cx, frame, points_.data(), points_.size(), color_, width_,
+              lineCapStyle_, widthScaling_, lineJoinStyle_);
+  };
+
+  Bounds bounds() const {
+    return pathBounds(points_.data(), points_.size(), width_, widthScaling_,
+                      lineJoinStyle_);
+  }
+
+  const std::vector<Vector>& points() const { return points_; }
+  const Color& color() const { return color_; }
+  double width() const { return width_; }
+  LineCapStyle lineCapStyle() const { return lineCapStyle_; }
+  LineWidthScaling widthScaling() const { return widthScaling_; }
+  LineJoinStyle lineJoinStyle() const { return lineJoinStyle_; }
+};
+
+class SegmentsPainter : public Painter
+{
+private:
+  std::vector<Vector> endpoints_;
+  const Color color_;
+  double width_;
+  LineCapStyle lineCapStyle_;
+  LineWidthScaling widthScaling_;
+
+public:
+  SegmentsPainter(const std::vector<Vector>& endpoints, const Color& color,
+                  double width, LineCapStyle lineCapStyle,
+                  LineWidthScaling widthScaling)
+    : endpoints_(endpoints), color_(color), width_(width),
+      lineCapStyle_(lineCapStyle), widthScaling_(widthScaling)
+  {
+    if (endpoints_.size() % 2)
+      abort();
+  }
+
+  void paint(DrawingContext &cx, const Frame& frame) const {
+    PaintScope scope(cx, "segments");
+    if (cx.culls(bounds(), frame))
+      return;
+    paintSegments(cx, frame, endpoints_.data(), endpoints_.size(), color_,
+                  width_, lineCapStyle_, widthScaling_);
+  };
+
+  Bounds bounds() const {
+    return pathBounds(endpoints_.data(), endpoints_.size(), width_,
+                      widthScaling_, LineJoinStyle::None);
+  }
+
+  const std::vector<Vector>& endpoints() const { return endpoints_; }
+  const Color& color() const { return color_; }
+  double width() const { return width_; }
+  LineCapStyle lineCapStyle() const { return lineCapStyle_; }
+  LineWidthScaling widthScaling() const { return widthScaling_; }
+};
+                      
+class ImagePainter : public Painter
+{
+private:
+  struct Level
+  {
+    uint32_t width;
+    uint32_t height;
+    std::vector<Color> pixels;
+  };
+
+  uint32_t width_;
+  uint32_t height_;
+  std::vector<Color> pixels_;
+  ImageSampling sampling_;
+  // For Mipmap sampling, the image at half the size of the level
+  // before, down to a single pixel.
+  std::vector<Level> levels_;
+
+public:
+  // Takes ownership of pixels.
+  ImagePainter(uint32_t width, uint32_t height,
+               std::vector<Color>&& pixels,
+               ImageSampling sampling = ImageSampling::Nearest)
+    : width_(width), height_(height), pixels_(std::move(pixels)),
+      sampling_(ImageSampling::Nearest)
+  {
+    if (width_ * height_ != pixels_.size())
+      abort();
+    setSampling(sampling);
+  }
+  
+  static ImagePainter* fromPPM(const char *fname);
+
+  void setSampling(ImageSampling sampling);
+
+  void paint(DrawingContext &cx, const Frame& frame) const;
+
+  Bounds bounds() const { return Bounds(Vector(0, 0), Vector(1, 1)); }
+
+  uint32_t width() const { return width_; }
+  uint32_t height() const { return height_; }
+  const std::vector<Color>& pixels() const { return pixels_; }
+  ImageSampling sampling() const { return sampling_; }
+};
+
+// Halve each dimension of SRC, averaging each 2x2 block of pixels.
+// Blocks at the edge of an odd-sized image repeat their last row or
+// column.
+static void halveImage(uint32_t width, uint32_t height, const Color* src,
+                       uint32_t* outWidth, uint32_t* outHeight,
+                       std::vector<Color>& out) {
+  uint32_t w = max(width / 2 + width % 2, 1u);
+  uint32_t h = max(height / 2 + height % 2, 1u);
+  out.resize(size_t(w) * h);
+  for (uint32_t y = 0; y < h; y++) {
+    const Color* r0 = src + size_t(min(2 * y, height - 1)) * width;
+    const Color* r1 = src + size_t(min(2 * y + 1, height - 1)) * width;
+    for (uint32_t x = 0; x < w; x++) {
+      uint32_t x0 = min(2 * x, width - 1), x1 = min(2 * x + 1, width - 1);
+      out[size_t(y) * w + x] =
+        Color((r0[x0].r + r0[x1].r + r1[x0].r + r1[x1].r + 2) / 4,
+              (r0[x0].g + r0[x1].g + r1[x0].g + r1[x1].g + 2) / 4,
+              (r0[x0].b + r0[x1].b + r1[x0].b + r1[x1].b + 2) / 4);
+    }
+  }
+  *outWidth = w;
+  *outHeight = h;
+}
+
+void ImagePainter::setSampling(ImageSampling sampling) {
+  sampling_ = sampling;
+  levels_.clear();
+  if (sampling != ImageSampling::Mipmap || pixels_.empty())
+    return;
+  uint32_t w = width_, h = height_;
+  const Color* src = pixels_.data();
+  while (w > 1 || h > 1) {
+    Level level;
+    halveImage(w, h, src, &level.width, &level.height, level.pixels);
+    levels_.push_back(std::move(level));
+    w = levels_.back().width;
+    h = levels_.back().height;
+    src = levels_.back().pixels.data();
+  }
+}
+
+// Source pixels per destination pixel, along the edge of FRAME with
+// the most, for a W by H image painted on CX.  Contexts that record
+// without a size, such as those of compile, get 0 so that the image
+// is kept at full size.
+static double imageScale(const DrawingContext& cx, const Frame& frame,
+                         uint32_t w, uint32_t h) {
+  if (cx.width() == 0 || cx.height() == 0)
+    return 0;
+  double e1 = Vector(frame.edge1.x * cx.width(),
+                     frame.edge1.y * cx.height()).magnitude();
+  double e2 = Vector(frame.edge2.x * cx.width(),
+                     frame.edge2.y * cx.height()).magnitude();
+  return max(w / e1, h / e2);
+}
+
+void ImagePainter::paint(DrawingContext &cx, const Frame& frame) const {
+  PaintScope scope(cx, "image");
+  uint32_t w = width_, h = height_;
+  const Color* pixels = pixels_.data();
+  if (sampling_ == ImageSampling::Mipmap) {
+    double scale = imageScale(cx, frame, w, h);
+    for (const Level& level : levels_) {
+      if (!(scale > 2.0))
+        break;
+      w = level.width;
+      h = level.height;
+      pixels = level.pixels.data();
+      scale /= 2.0;
+    }
+  }
+  cx.drawPixels(w, h, pixels, frame.origin, frame.edge1, frame.edge2,
+                sampling_);
+}
+
+class TransformPainter : public Painter
+{
+private:
+  PainterPtr painter_;
+  const Frame frame_;
+  const Bounds bounds_;
+
+public:
+  TransformPainter(PainterPtr painter,
+                   const Vector& origin, const Vector& corner1,
+                   const Vector& corner2)
+    : painter_(painter),
+      frame_(origin, corner1.sub(origin), corner2.sub(origin)),
+      bounds_(painter->bounds().project(frame_))
+  {}
+
+  TransformPainter(PainterPtr painter, const Frame& frame)
+    : painter_(painter), frame_(frame),
+      bounds_(painter->bounds().project(frame_))
+  {}
+  
+  void paint(DrawingContext &cx, const Frame& frame) const {
+    PaintScope scope(cx, "transform");
+    COUNT(cx.stats().transforms++);
+    if (cx.culls(bounds_, frame))
+      return;
+    Frame projected = frame.project(frame_);
+    if (!cx.paintCached(painter_, projected))
+      painter_->paint(cx, projected);
+  }
+
+  Bounds bounds() const { return bounds_; }
+
+  const PainterPtr& painter() const { return painter_; }
+  const Frame& frame() const { return frame_; }
+};
+
+class OverPainter : public Painter
+{
+private:
+  PainterPtr first_;
+  PainterPtr second_;
+  const Bounds bounds_;
+
+public:
+  OverPainter(PainterPtr first, PainterPtr second)
+    : first_(first), second_(second),
+      bounds_(first->bounds().join(second->bounds())) {}
+  
+  void paint(DrawingContext &cx, const Frame& frame) const {
+    PaintScope scope(cx, "over");
+    if (cx.culls(bounds_, frame))
+      return;
+    first_->paint(cx, frame);
+    second_->paint(cx, frame);
+  }
+
+  Bounds bounds() const { return bounds_; }
+
+  const PainterPtr& first() const { return first_; }
+  const PainterPtr& second() const { return second_; }
+};
+
+class OpacityPainter : public Painter
+{
+private:
+  PainterPtr painter_;
+  const double alpha_;
+
+public:
+  OpacityPainter(PainterPtr painter, double alpha)
+    : painter_(painter), alpha_(alpha) {}
+
+  void paint(DrawingContext &cx, const Frame& frame) const {
+    PaintScope scope(cx, "opacity");
+    if (cx.culls(bounds(), frame))
+      return;
+    cx.paintTranslucent(*painter_, frame, alpha_);
+  }
+
+  Bounds bounds() const { return painter_->bounds(); }
+
+  const PainterPtr& painter() const { return painter_; }
+  double alpha() const { return alpha_; }
+};
+
+// An n-ary version of OverPainter, made by simplify.
+class GroupPainter : public Painter
+{
+private:
+  std::vector<PainterPtr> painters_;
+  const Bounds bounds_;
+
+  static Bounds join(const std::vector<PainterPtr>& painters) {
+    Bounds ret = painters[0]->bounds();
+    for (const PainterPtr& p : painters)
+      ret = ret.join(p->bounds());
+    return ret;
+  }
+
+public:
+  explicit GroupPainter(std::vector<PainterPtr>&& painters)
+    : painters_(painters), bounds_(join(painters_)) {}
+
+  void paint(DrawingContext &cx, const Frame& frame) const {
+    PaintScope scope(cx, "group");
+    if (cx.culls(bounds_, frame))
+      return;
+    for (const PainterPtr& p : painters_)
+      p->paint(cx, frame);
+  }
+
+  Bounds bounds() const { return bounds_; }
+
+  const std::vector<PainterPtr>& painters() const { return painters_; }
+};
+
+PainterPtr triangle(const Vector& a, const Vector& b, const Vector& c,
+                    const Color& color) {
+  return PainterPtr(new TrianglePainter(a, b, c, color));
+}
+
+PainterPtr path(const std::vector<Vector>& points, const Color& color,
+                double width, LineCapStyle lineCapStyle,
+                LineWidthScaling widthScaling, LineJoinStyle lineJoinStyle) {
+
+  return PainterPtr(new PathPainter(points, color, width,
+                                    lineCapStyle, widthScaling,
+                                    lineJoinStyle));
+}
+
+PainterPtr segments(const std::vector<Vector>& endpoints, const Color& color,
+                    double width, LineCapStyle lineCapStyle,
+                    LineWidthScaling widthScaling) {
+  return PainterPtr(new SegmentsPainter(endpoints, color, width,
+                                        lineCapStyle, widthScaling));
+}
+
+PainterPtr image(uint32_t width, uint32_t height, std::vector<Color>&& pixels,
+                 ImageSampling sampling) {
+  return PainterPtr(new ImagePainter(width, height, std::move(pixels),
+                                     sampling));
+}
+
+PainterPtr image(const char *fname, ImageSampling sampling) {
+  ImagePainter *ret = ImagePainter::fromPPM(fname);
+  if (ret)
+    ret->setSampling(sampling);
+  return PainterPtr(ret);
+}
+
+// A parser for binary PPM (P6) and PGM (P5) files, following the
+// netpbm header grammar: the magic number, then width, height and
+// maxval, separated by whitespace and comments running from "#" to the
+// end of the line, then a single whitespace character, then the samples.
+class PNMReader
+{
+private:
+  const char *fname_;
+  const uint8_t *data_;
+  size_t size_;
+  size_t pos_;
+
+  void skipSpaceAndComments() {
+    while (pos_ < size_) {
+      if (data_[pos_] == '#') {
+        while (pos_ < size_ && data_[pos_] != '\n' && data_[pos_] != '\r')
+          pos_++;
+      } else if (isspace(data_[pos_])) {
+        pos_++;
+      } else {
+        break;
+      }
+    }
+  }
+
+  bool readUnsigned(uint32_t& out) {
+    skipSpaceAndComments();
+    uint64_t value = 0;
+    size_t start = pos_;
+    while (pos_ < size_ && isdigit(data_[pos_]) && value <= UINT32_MAX)
+      value = value * 10 + (data_[pos_++] - '0');
+    if (pos_ == start || value > UINT32_MAX)
+      return false;
+    out = uint32_t(value);
+    return true;
+  }
+
+public:
+  PNMReader(const char *fname, const uint8_t* data, size_t size)
+    : fname_(fname), data_(data), size_(size), pos_(0) {}
+
+  ImagePainter* read() {
+    if (size_ < 2 || data_[0] != 'P' || (data_[1] != '5' && data_[1] != '6')) {
+      fprintf(stderr, "expected PPM or PGM header on %s\n", fname_);
+      return nullptr;
+    }
+    bool gray = data_[1] == '5';
+    pos_ = 2;
+    uint32_t width, height, maxval;
+    if (!readUnsigned(width) || !readUnsigned(height)
+        || !readUnsigned(maxval) || pos_ >= size_ || !isspace(data_[pos_])) {
+      fprintf(stderr, "bad PPM header on %s\n", fname_);
+      return nullptr;
+    }
+    pos_++;
+    if (uint64_t(width) * height == 0 || uint64_t(width) * height > SIZE_MAX / 8) {
+      fprintf(stderr, "bad dimensions for PPM file %s: %u x %u\n", fname_,
+              width, height);
+      return nullptr;
+    }
+    if (maxval == 0 || maxval > 65535) {
+      fprintf(stderr, "bad maxval for PPM file %s: %u\n", fname_, maxval);
+      return nullptr;
+    }
+
+    size_t count = size_t(width) * height;
+    size_t sampleSize = maxval < 256 ? 1 : 2;
+    size_t channels = gray ? 1 : 3;
+    size_t bytes = count * channels * sampleSize;
+    if (size_ - pos_ < bytes) {
+      fprintf(stderr, "got EOF while reading PPM data from %s\n", fname_);
+      return nullptr;
+    }
+    if (size_ - pos_ > bytes) {
+      fprintf(stderr, "expected EOF after reading PPM data from %s\n", fname_);
+      return nullptr;
+    }
+
+    const uint8_t *samples = data_ + pos_;
+    std::vector<Color> pixels(count);
+    if (!gray && maxval == 255) {
+      memcpy(pixels.data(), samples, bytes);
+    } else {
+      auto sample = [&](size_t i) -> uint8_t {
+        uint32_t v = sampleSize == 1
+          ? samples[i] : (uint32_t(samples[2 * i]) << 8) | samples[2 * i + 1];
+        return uint8_t((min(v, maxval) * 255 + maxval / 2) / maxval);
+      };
+      for (size_t i = 0; i < count; i++) {
+        if (gray)
+          pixels[i] = Color(sample(i));
+        else
+          pixels[i] = Color(sample(3 * i), sample(3 * i + 1), sample(3 * i + 2));
+      }
+    }
+
+    return new ImagePainter(width, height, std::move(pixels));
+  }
+};
+
+ImagePainter* ImagePainter::fromPPM(const char *fname) {
+  FILE *f = fopen(fname, "rb");
+  if (!f) {
+    fprintf(stderr, "failed to open %s: ", fname);
+    perror(NULL);
+    return nullptr;
+  }
+
+#ifdef HAVE_MMAP
+  struct stat st;
+  if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE,
+                      fileno(f), 0);
+    if (data != MAP_FAILED) {
+      ImagePainter *ret =
+        PNMReader(fname, static_cast<const uint8_t*>(data), st.st_size).read();
+      munmap(data, st.st_size);
+      fclose(f);
+      return ret;
+    }
+  }
+#endif
+
+  // Fall back to reading the whole file.
+  std::vector<uint8_t> data;
+  uint8_t buf[65536];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  if (ferror(f)) {
+    fprintf(stderr, "failed to read %s: ", fname);
+    perror(NULL);
+    fclose(f);
+    return nullptr;
+  }
+  fclose(f);
+  return PNMReader(fname, data.data(), data.size()).read();
+}
+
+PainterPtr transform(PainterPtr painter,
+                     const Vector& origin, const Vector& corner1,
+                     const Vector& corner2) {
+  return PainterPtr(new TransformPainter(painter, origin, corner1, corner2));
+}
+
+PainterPtr over(PainterPtr a, PainterPtr b) {
+  return PainterPtr(new OverPainter(a, b));
+}
+
+PainterPtr opacity(PainterPtr p, double alpha) {
+  return PainterPtr(new OpacityPainter(p, alpha));
+}
+
+PainterPtr over(PainterPtr a, PainterPtr b, double alpha) {
+  return over(a, opacity(b, alpha));
+}
+
+PainterPtr parallelogram(const Vector& origin, const Vector& edge1,
+                         const Vector& edge2, const Color& color) {
+  return PainterPtr(new ParallelogramPainter(origin, edge1, edge2, color));
+}
+              
+PainterPtr color(const Color& color) {
+  return parallelogram(Vector(0,0), Vector(1,0), Vector(0,1), color);
+}
+
+PainterPtr flipHoriz(PainterPtr painter) {
+  return transform(painter, Vector(1, 0), Vector(0, 0), Vector(1, 1));
+};
+
+PainterPtr flipVert(PainterPtr painter) {
+  return transform(painter, Vector(0, 1), Vector(1, 1), Vector(0, 0));
+};
+
+PainterPtr rotate90(PainterPtr painter) {
+  return transform(painter,Vector(1, 0), Vector(1, 1), Vector(0, 0));
+};
+
+PainterPtr rotate180(PainterPtr painter) {
+  return rotate90(rotate90(painter));
+};
+
+PainterPtr rotate270(PainterPtr painter) {
+  return rotate90(rotate90(rotate90(painter)));
+};
+
+PainterPtr beside(PainterPtr a, PainterPtr b) {
+  return over(transform(a, Vector(0,0), Vector(0.5,0), Vector(0,1)),
+              transform(b, Vector(0.5,0), Vector(1,0), Vector(0.5,1)));
+};
+
+PainterPtr below(PainterPtr a, PainterPtr b) {
+  return rotate270(beside(rotate90(b), rotate90(a)));
+};
+
+PainterPtr beside3(PainterPtr a, PainterPtr b, PainterPtr c) {
+  return over
+    (transform(a, Vector(0,0), Vector(1/3.,0), Vector(0,1)),
+     over(transform(b, Vector(1/3.,0), Vector(2/3.,0), Vector(1/3.,1)),
+          transform(c, Vector(2/3.,0), Vector(1,0), Vector(2/3.,1))));
+};
+
+PainterPtr above3(PainterPtr a, PainterPtr b, PainterPtr c) {
+  return over
+    (transform(a, Vector(0,2/3.), Vector(1,2/3.), Vector(0,1)),
+     over(transform(b, Vector(0,1/3.), Vector(1,1/3.), Vector(0,2/3.)),
+          transform(c, Vector(0,0), Vector(1,0), Vector(0,1./3.))));
+};
+
+PainterPtr black() { return color(Color::black()); }
+PainterPtr gray() { return color(Color::gray()); }
+PainterPtr white() { return color(Color::white()); }
+PainterPtr blue() { return color(Color::blue()); }
+PainterPtr red() { return color(Color::red()); }
+
+// (define diagonal-shading (procedure->painter (λ (x y) (* 100 (+ x y)))))
+// (define einstein         (bitmap->painter einstein-file))
+
+PainterArena::PainterArena()
+  : nodeData_(nullptr), boundsData_(nullptr), pointData_(nullptr),
+    scalarData_(nullptr), pixelData_(nullptr), size_(0), pointCount_(0),
+    scalarCount_(0), pixelCount_(0) {}
+
+// Copy the arrays of a loaded file into the arena's own, so that they
+// can grow.
+void PainterArena::own() {
+  if (!file_)
+    return;
+  nodes_.assign(nodeData_, nodeData_ + size_);
+  bounds_.assign(boundsData_, boundsData_ + size_);
+  points_.assign(pointData_, pointData_ + pointCount_);
+  scalars_.assign(scalarData_, scalarData_ + scalarCount_);
+  pixels_.assign(pixelData_, pixelData_ + pixelCount_);
+  file_.reset();
+  sync();
+}
+
+// Point the arrays that painting reads at the arena's own.
+void PainterArena::sync() {
+  nodeData_ = nodes_.data();
+  boundsData_ = bounds_.data();
+  pointData_ = points_.data();
+  scalarData_ = scalars_.data();
+  pixelData_ = pixels_.data();
+  size_ = nodes_.size();
+  pointCount_ = points_.size();
+  scalarCount_ = scalars_.size();
+  pixelCount_ = pixels_.size();
+}
+
+void PainterArena::reserve(size_t nodes) {
+  own();
+  nodes_.reserve(nodes);
+  bounds_.reserve(nodes);
+  sync();
+}
+
+PainterId PainterArena::add(const Node& node, const Bounds& bounds) {
+  if (nodes_.size() >= UINT32_MAX)
+    abort();
+  nodes_.push_back(node);
+  bounds_.push_back(bounds);
+  sync();
+  return PainterId(nodes_.size() - 1);
+}
+
+Frame PainterArena::frame(const Node& node) const {
+  const double *f = &scalarData_[node.second];
+  return Frame(Vector(f[0], f[1]), Vector(f[2], f[3]), Vector(f[4], f[5]));
+}
+
+PainterId PainterArena::triangle(const Vector& a, const Vector& b,
+                                 const Vector& c, const Color& color) {
+  own();
+  uint32_t first = points_.size();
+  points_.insert(points_.end(), { a, b, c });
+  return add(Node{Kind::Triangle, LineCapStyle::Butt,
+                  LineWidthScaling::Unscaled, color, LineJoinStyle::None,
+                  ImageSampling::Nearest, first, 0, 0},
+             Bounds::of(&points_[first], 3));
+}
+
+PainterId PainterArena::path(const std::vector<Vector>& points,
+                             const Color& color, double width,
+                             LineCapStyle lineCapStyle,
+                             LineWidthScaling widthScaling,
+                             LineJoinStyle lineJoinStyle) {
+  own();
+  uint32_t first = points_.size();
+  points_.insert(points_.end(), points.begin(), points.end());
+  uint32_t widthIndex = scalars_.size();
+  scalars_.push_back(width);
+  return add(Node{Kind::Path, lineCapStyle, widthScaling, color,
+                  lineJoinStyle, ImageSampling::Nearest, first,
+                  uint32_t(points.size()), widthIndex},
+             pathBounds(points.data(), points.size(), width, widthScaling,
+                        lineJoinStyle));
+}
+
+PainterId PainterArena::segments(const std::vector<Vector>& endpoints,
+                                 const Color& color, double width,
+                                 LineCapStyle lineCapStyle,
+                                 LineWidthScaling widthScaling) {
+  if (endpoints.size() % 2)
+    abort();
+  own();
+  uint32_t first = points_.size();
+  points_.insert(points_.end(), endpoints.begin(), endpoints.end());
+  uint32_t widthIndex = scalars_.size();
+  scalars_.push_back(width);
+  return add(Node{Kind::Segments, lineCapStyle, widthScaling, color,
+                  LineJoinStyle::None, ImageSampling::Nearest, first,
+                  uint32_t(endpoints.size()), widthIndex},
+             pathBounds(endpoints.data(), endpoints.size(), width,
+                        widthScaling, LineJoinStyle::None));
+}
+
+// The number of pixels in a W by H image and, if MIPMAP, all of its
+// halvings down to a single pixel, as ImagePainter makes.
+static uint64_t imagePixels(uint32_t w, uint32_t h, bool mipmap) {
+  uint64_t ret = uint64_t(w) * h;
+  if (mipmap && ret) {
+    while (w > 1 || h > 1) {
+      w = max(w / 2 + w % 2, 1u);
+      h = max(h / 2 + h % 2, 1u);
+      ret += uint64_t(w) * h;
+    }
+  }
+  return ret;
+}
+
+PainterId PainterArena::image(uint32_t width, uint32_t height,
+                              const std::vector<Color>& pixels,
+                              ImageSampling sampling) {
+  if (size_t(width) * height != pixels.size())
+    abort();
+  own();
+  uint32_t first = pixels_.size();
+  pixels_.insert(pixels_.end(), pixels.begin(), pixels.end());
+  if (sampling == ImageSampling::Mipmap && !pixels.empty()) {
+    uint32_t w = width, h = height;
+    size_t level = first;
+    std::vector<Color> half;
+    while (w > 1 || h > 1) {
+      halveImage(w, h, &pixels_[level], &w, &h, half);
+      level = pixels_.size();
+      pixels_.insert(pixels_.end(), half.begin(), half.end());
+    }
+  }
+  return add(Node{Kind::Image, LineCapStyle::Butt, LineWidthScaling::Unscaled,
+                  Color(), LineJoinStyle::None, sampling, first, width,
+                  height},
+             Bounds(Vector(0, 0), Vector(1, 1)));
+}
+
+PainterId PainterArena::transform(PainterId painter, const Vector& origin,
+                                  const Vector& corner1,
+                                  const Vector& corner2) {
+  return transform(painter,
+                   Frame(origin, corner1.sub(origin), corner2.sub(origin)));
+}
+
+PainterId PainterArena::transform(PainterId painter, const Frame& f) {
+  if (painter >= size_)
+    abort();
+  own();
+  uint32_t frameIndex = scalars_.size();
+  scalars_.insert(scalars_.end(), { f.origin.x, f.origin.y, f.edge1.x,
+                                    f.edge1.y, f.edge2.x, f.edge2.y });
+  return add(Node{Kind::Transform, LineCapStyle::Butt,
+                  LineWidthScaling::Unscaled, Color(), LineJoinStyle::None,
+                  ImageSampling::Nearest, painter, frameIndex, 0},
+             bounds_[painter].project(f));
+}
+
+PainterId PainterArena::over(PainterId a, PainterId b) {
+  if (a >= size_ || b >= size_)
+    abort();
+  own();
+  return add(Node{Kind::Over, LineCapStyle::Butt, LineWidthScaling::Unscaled,
+                  Color(), LineJoinStyle::None, ImageSampling::Nearest, a, b,
+                  0},
+             bounds_[a].join(bounds_[b]));
+}
+
+PainterId PainterArena::opacity(PainterId painter, double alpha) {
+  if (painter >= size_)
+    abort();
+  own();
+  uint32_t alphaIndex = scalars_.size();
+  scalars_.push_back(alpha);
+  return add(Node{Kind::Opacity, LineCapStyle::Butt,
+                  LineWidthScaling::Unscaled, Color(), LineJoinStyle::None,
+                  ImageSampling::Nearest, painter, alphaIndex, 0},
+             bounds_[painter]);
+}
+
+PainterId PainterArena::parallelogram(const Vector& origin,
+                                      const Vector& edge1,
+                                      const Vector& edge2,
+                                      const Color& color) {
+  own();
+  uint32_t first = points_.size();
+  points_.insert(points_.end(), { origin, edge1, edge2 });
+  return add(Node{Kind::Parallelogram, LineCapStyle::Butt,
+                  LineWidthScaling::Unscaled, color, LineJoinStyle::None,
+                  ImageSampling::Nearest, first, 0, 0},
+             Bounds::of({origin, origin.add(edge1),
+                         origin.add(edge1).add(edge2), origin.add(edge2)}));
+}
+
+PainterId PainterArena::color(const Color& color) {
+  return parallelogram(Vector(0,0), Vector(1,0), Vector(0,1), color);
+}
+
+PainterId PainterArena::flipHoriz(PainterId painter) {
+  return transform(painter, Vector(1, 0), Vector(0, 0), Vector(1, 1));
+}
+
+PainterId PainterArena::flipVert(PainterId painter) {
+  return transform(painter, Vector(0, 1), Vector(1, 1), Vector(0, 0));
+}
+
+PainterId PainterArena::rotate90(PainterId painter) {
+  return transform(painter, Vector(1, 0), Vector(1, 1), Vector(0, 0));
+}
+
+PainterId PainterArena::rotate180(PainterId painter) {
+  return rotate90(rotate90(painter));
+}
+
+PainterId PainterArena::rotate270(PainterId painter) {
+  return rotate90(rotate90(rotate90(painter)));
+}
+
+PainterId PainterArena::beside(PainterId a, PainterId b) {
+  return over(transform(a, Vector(0,0), Vector(0.5,0), Vector(0,1)),
+              transform(b, Vector(0.5,0), Vector(1,0), Vector(0.5,1)));
+}
+
+PainterId PainterArena::below(PainterId a, PainterId b) {
+  return rotate270(beside(rotate90(b), rotate90(a)));
+}
+
+PainterId PainterArena::beside3(PainterId a, PainterId b, PainterId c) {
+  return over
+    (transform(a, Vector(0,0), Vector(1/3.,0), Vector(0,1)),
+     over(transform(b, Vector(1/3.,0), Vector(2/3.,0), Vector(1/3.,1)),
           transform(c, Vector(2/3.,0), Vector(1,0), Vector(2/3.,1))));
+}
+
+PainterId PainterArena::above3(PainterId a, PainterId b, PainterId c) {
+  return over
+    (transform(a, Vector(0,2/3.), Vector(1,2/3.), Vector(0,1)),
+     over(transform(b, Vector(0,1/3.), Vector(1,1/3.), Vector(0,2/3.)),
+          transform(c, Vector(0,0), Vector(1,0), Vector(0,1./3.))));
+}
+
+// A painter of an arena as a Painter, for paintTranslucent.
+class ArenaNodePainter : public Painter
+{
+private:
+  const PainterArena& arena_;
+  PainterId id_;
+
+public:
+  ArenaNodePainter(const PainterArena& arena, PainterId id)
+    : arena_(arena), id_(id) {}
+
+  void paint(DrawingContext &cx, const Frame& frame) const {
+    arena_.paintNode(cx, id_, frame);
+  }
+
+  Bounds bounds() const { return arena_.bounds(id_); }
+};
+
+void PainterArena::paintNode(DrawingContext& cx, PainterId id,
+                             const Frame& frame) const {
+  static const char *const names[] = {
+    "triangle", "path", "segments", "image", "transform", "over", "opacity",
+    "parallelogram"
+  };
+  const Node& node = nodeData_[id];
+  PaintScope scope(cx, names[size_t(node.kind)]);
+  switch (node.kind) {
+  case Kind::Triangle: {
+    const Vector *p = &pointData_[node.first];
+    cx.drawTriangle(frame.project(p[0]), frame.project(p[1]),
+                    frame.project(p[2]), node.color);
+    break;
+  }
+  case Kind::Parallelogram: {
+    const Vector *p = &pointData_[node.first];
+    cx.drawQuad(frame.project(p[0]), frame.project(p[0].add(p[1])),
+                frame.project(p[0].add(p[1]).add(p[2])),
+                frame.project(p[0].add(p[2])), node.color);
+    break;
+  }
+  case Kind::Path:
+    if (!cx.culls(boundsData_[id], frame))
+      paintPath(cx, frame, &pointData_[node.first], node.second, node.color,
+                scalarData_[node.third], node.lineCapStyle,
+                node.widthScaling, node.lineJoinStyle);
+    break;
+  case Kind::Segments:
+    if (!cx.culls(boundsData_[id], frame))
+      paintSegments(cx, frame, &pointData_[node.first], node.second,
+                    node.color, scalarData_[node.third], node.lineCapStyle,
+                    node.widthScaling);
+    break;
+  case Kind::Image: {
+    uint32_t w = node.second, h = node.third;
+    const Color *pixels = &pixelData_[node.first];
+    // Step through the levels as ImagePainter::paint does.
+    if (node.sampling == ImageSampling::Mipmap && w && h) {
+      for (double scale = imageScale(cx, frame, w, h);
+           scale > 2.0 && (w > 1 || h > 1); scale /= 2.0) {
+        pixels += size_t(w) * h;
+        w = max(w / 2 + w % 2, 1u);
+        h = max(h / 2 + h % 2, 1u);
+      }
+    }
+    cx.drawPixels(w, h, pixels, frame.origin, frame.edge1, frame.edge2,
+                  node.sampling);
+    break;
+  }
+  case Kind::Transform:
+    COUNT(cx.stats().transforms++);
+    if (!cx.culls(boundsData_[id], frame))
+      paintNode(cx, node.first, frame.project(this->frame(node)));
+    break;
+  case Kind::Over:
+    if (!cx.culls(boundsData_[id], frame)) {
+      paintNode(cx, node.first, frame);
+      paintNode(cx, node.second, frame);
+    }
+    break;
+  case Kind::Opacity:
+    if (!cx.culls(boundsData_[id], frame))
+      cx.paintTranslucent(ArenaNodePainter(*this, node.first), frame,
+                          scalarData_[node.second]);
+    break;
+  default:
+    abort();
+  }
+}
+
+void PainterArena::paint(DrawingContext& cx, PainterId root) const {
+  if (root >= size_)
+    abort();
+  cx.fill(Color::white());
+  paintNode(cx, root, Frame(Vector(0,0), Vector(1,0), Vector(0,1)));
+}
+
+class ArenaPainter : public Painter
+{
+private:
+  std::shared_ptr<const PainterArena> arena_;
+  PainterId root_;
+
+public:
+  ArenaPainter(std::shared_ptr<const PainterArena> arena, PainterId root)
+    : arena_(arena), root_(root) {}
+
+  void paint(DrawingContext &cx, const Frame& frame) const {
+    arena_->paintNode(cx, root_, frame);
+  }
+
+  Bounds bounds() const { return arena_->bounds(root_); }
+
+  const PainterArena& arena() const { return *arena_; }
+  PainterId root() const { return root_; }
+};
+
+PainterPtr painter(std::shared_ptr<const PainterArena> arena, PainterId root) {
+  if (root >= arena->size())
+    abort();
+  return PainterPtr(new ArenaPainter(arena, root));
+}
+
+// Adds painter graphs to an arena, for PainterArena::copy.  Painters and
+// the nodes of other arenas are keyed by address, so that each is only
+// added once.
+class ArenaCopier
+{
+private:
+  PainterArena& arena_;
+  std::unordered_map<const void*, PainterId> ids_;
+
+public:
+  explicit ArenaCopier(PainterArena& arena) : arena_(arena) {}
+
+  bool copy(const Painter* p, PainterId* id);
+  bool copy(const PainterArena& from, PainterId node, PainterId* id);
+};
+
+bool ArenaCopier::copy(const Painter* p, PainterId* id) {
+  auto found = ids_.find(p);
+  if (found != ids_.end()) {
+    *id = found->second;
+    return true;
+  }
+
+  PainterId a, b;
+  if (auto t = dynamic_cast<const TrianglePainter*>(p)) {
+    *id = arena_.triangle(t->a(), t->b(), t->c(), t->color());
+  } else if (auto q = dynamic_cast<const ParallelogramPainter*>(p)) {
+    *id = arena_.parallelogram(q->origin(), q->edge1(), q->edge2(),
+                               q->color());
+  } else if (auto path = dynamic_cast<const PathPainter*>(p)) {
+    *id = arena_.path(path->points(), path->color(), path->width(),
+                      path->lineCapStyle(), path->widthScaling(),
+                      path->lineJoinStyle());
+  } else if (auto s = dynamic_cast<const SegmentsPainter*>(p)) {
+    *id = arena_.segments(s->endpoints(), s->color(), s->width(),
+                          s->lineCapStyle(), s->widthScaling());
+  } else if (auto image = dynamic_cast<const ImagePainter*>(p)) {
+    *id = arena_.image(image->width(), image->height(), image->pixels(),
+                       image->sampling());
+  } else if (auto t = dynamic_cast<const TransformPainter*>(p)) {
+    if (!copy(t->painter().get(), &a))
+      return false;
+    *id = arena_.transform(a, t->frame());
+  } else if (auto o = dynamic_cast<const OverPainter*>(p)) {
+    if (!copy(o->first().get(), &a) || !copy(o->second().get(), &b))
+      return false;
+    *id = arena_.over(a, b);
+  } else if (auto o = dynamic_cast<const OpacityPainter*>(p)) {
+    if (!copy(o->painter().get(), &a))
+      return false;
+    *id = arena_.opacity(a, o->alpha());
+  } else if (auto g = dynamic_cast<const GroupPainter*>(p)) {
+    // Overs paint in the same order as the group.
+    if (!copy(g->painters()[0].get(), &a))
+      return false;
+    for (size_t i = 1; i < g->painters().size(); i++) {
+      if (!copy(g->painters()[i].get(), &b))
+        return false;
+      a = arena_.over(a, b);
+    }
+    *id = a;
+  } else if (auto arena = dynamic_cast<const ArenaPainter*>(p)) {
+    if (!copy(arena->arena(), arena->root(), id))
+      return false;
+  } else {
+    fprintf(stderr, "can't add a painter of unknown type to an arena\n");
+    return false;
+  }
+  ids_[p] = *id;
+  return true;
+}
+
+bool ArenaCopier::copy(const PainterArena& from, PainterId node,
+                       PainterId* id) {
+  if (&from == &arena_) {
+    *id = node;
+    return true;
+  }
+  const PainterArena::Node& n = from.node(node);
+  auto found = ids_.find(&n);
+  if (found != ids_.end()) {
+    *id = found->second;
+    return true;
+  }
+
+  using Kind = PainterArena::Kind;
+  const Vector *points = &from.pointData_[n.first];
+  PainterId a, b;
+  switch (n.kind) {
+  case Kind::Triangle:
+    *id = arena_.triangle(points[0], points[1], points[2], n.color);
+    break;
+  case Kind::Parallelogram:
+    *id = arena_.parallelogram(points[0], points[1], points[2], n.color);
+    break;
+  case Kind::Path:
+    *id = arena_.path(std::vector<Vector>(points, points + n.second),
+                      n.color, from.scalarData_[n.third], n.lineCapStyle,
+                      n.widthScaling, n.lineJoinStyle);
+    break;
+  case Kind::Segments:
+    *id = arena_.segments(std::vector<Vector>(points, points + n.second),
+                          n.color, from.scalarData_[n.third],
+                          n.lineCapStyle, n.widthScaling);
+    break;
+  case Kind::Image: {
+    const Color *pixels = &from.pixelData_[n.first];
+    *id = arena_.image(n.second, n.third,
+                       std::vector<Color>(pixels,
+                                          pixels + size_t(n.second) * n.third),
+                       n.sampling);
+    break;
+  }
+  case Kind::Transform:
+    if (!copy(from, n.first, &a))
+      return false;
+    *id = arena_.transform(a, from.frame(n));
+    break;
+  case Kind::Over:
+    if (!copy(from, n.first, &a) || !copy(from, n.second, &b))
+      return false;
+    *id = arena_.over(a, b);
+    break;
+  case Kind::Opacity:
+    if (!copy(from, n.first, &a))
+      return false;
+    *id = arena_.opacity(a, from.scalarData_[n.second]);
+    break;
+  default:
+    abort();
+  }
+  ids_[&n] = *id;
+  return true;
+}
+
+bool PainterArena::copy(PainterPtr p, PainterId* root) {
+  return ArenaCopier(*this).copy(p.get(), root);
+}
+
+// The start of a scene file.  The arrays follow, each at an offset that
+// is a multiple of eight.  Bump the version when the layout changes.
+struct SceneHeader
+{
+  char magic[8];
+  uint32_t version;
+  // 0x01020304 as the machine that wrote the file stores it.
+  uint32_t byteOrder;
+  // The sizes of Node, Bounds, Vector, double and Color.
+  uint32_t sizes[5];
+  PainterId root;
+  // The lengths and offsets of the nodes, bounds, points, scalars and
+  // pixels.
+  uint64_t counts[5];
+  uint64_t offsets[5];
 };
 
-PainterPtr above3(PainterPtr a, PainterPtr b, PainterPtr c) {
-  return over
-    (transform(a, Vector(0,2/3.), Vector(1,2/3.), Vector(0,1)),
-     over(transform(b, Vector(0,1/3.), Vector(1,1/3.), Vector(0,2/3.)),
-          transform(c, Vector(0,0), Vector(1,0), Vector(0,1./3.))));
+static_assert(sizeof(SceneHeader) == 120, "SceneHeader should be packed");
+static_assert(sizeof(PainterArena::Node) == 20,
+              "PainterArena::Node should be packed");
+
+static const char kSceneMagic[8] = { 'p', 'i', 'c', 't', 'i', 'e', 0, '\n' };
+static const uint32_t kSceneVersion = 2;
+static const uint32_t kSceneByteOrder = 0x01020304;
+static const uint32_t kSceneSizes[5] = {
+  sizeof(PainterArena::Node), sizeof(Bounds), sizeof(Vector), sizeof(double),
+  sizeof(Color)
+};
+
+bool PainterArena::save(const char *fname, PainterId root) const {
+  if (root >= size_) {
+    fprintf(stderr, "can't save %s: no painter %u in the arena\n", fname,
+            root);
+    return false;
+  }
+
+  SceneHeader header = {};
+  memcpy(header.magic, kSceneMagic, sizeof(header.magic));
+  header.version = kSceneVersion;
+  header.byteOrder = kSceneByteOrder;
+  memcpy(header.sizes, kSceneSizes, sizeof(header.sizes));
+  header.root = root;
+  const void *arrays[5] = {
+    nullptr, boundsData_, pointData_, scalarData_, pixelData_
+  };
+  const size_t counts[5] = {
+    size_, size_, pointCount_, scalarCount_, pixelCount_
+  };
+  uint64_t offset = sizeof(header);
+  for (size_t i = 0; i < 5; i++) {
+    offset = (offset + 7) & ~uint64_t(7);
+    header.counts[i] = counts[i];
+    header.offsets[i] = offset;
+    offset += uint64_t(counts[i]) * kSceneSizes[i];
+  }
+
+  FILE *f = fopen(fname, "wb");
+  if (!f) {
+    fprintf(stderr, "failed to create %s: ", fname);
+    perror(NULL);
+    return false;
+  }
+  // Copy the nodes field by field into zeroed memory, so that their
+  // padding is zero and saving the same arena twice gives the same file.
+  std::vector<Node> nodes(size_);
+  for (size_t i = 0; i < size_; i++) {
+    const Node& n = nodeData_[i];
+    nodes[i].kind = n.kind;
+    nodes[i].lineCapStyle = n.lineCapStyle;
+    nodes[i].widthScaling = n.widthScaling;
+    nodes[i].color = n.color;
+    nodes[i].lineJoinStyle = n.lineJoinStyle;
+    nodes[i].sampling = n.sampling;
+    nodes[i].first = n.first;
+    nodes[i].second = n.second;
+    nodes[i].third = n.third;
+  }
+  arrays[0] = nodes.data();
+
+  static const uint8_t padding[8] = {};
+  bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+  offset = sizeof(header);
+  for (size_t i = 0; i < 5 && ok; i++) {
+    size_t pad = header.offsets[i] - offset;
+    ok = fwrite(padding, 1, pad, f) == pad
+      && fwrite(arrays[i], kSceneSizes[i], counts[i], f) == counts[i];
+    offset = header.offsets[i] + uint64_t(counts[i]) * kSceneSizes[i];
+  }
+  if (!ok || fflush(f) != 0) {
+    perror("writing scene file failed");
+    fclose(f);
+    return false;
+  }
+  if (fclose(f) != 0) {
+    perror("writing scene file failed");
+    return false;
+  }
+  return true;
+}
+
+// Whether the nodes of a scene file only refer to parts of its arrays
+// that exist, and to painters before them, so that painting can't read
+// out of bounds or recurse forever.
+static bool checkScene(const SceneHeader& header,
+                       const PainterArena::Node* nodes) {
+  using Kind = PainterArena::Kind;
+  const uint64_t points = header.counts[2], scalars = header.counts[3];
+  const uint64_t pixels = header.counts[4];
+  for (uint64_t i = 0; i < header.counts[0]; i++) {
+    const PainterArena::Node& n = nodes[i];
+    if (uint32_t(n.lineCapStyle) > uint32_t(LineCapStyle::Square)
+        || uint32_t(n.widthScaling) > uint32_t(LineWidthScaling::Unscaled)
+        || uint8_t(n.lineJoinStyle) > uint8_t(LineJoinStyle::Round)
+        || uint32_t(n.sampling) > uint32_t(ImageSampling::Mipmap))
+      return false;
+    bool ok;
+    switch (n.kind) {
+    case Kind::Triangle:
+    case Kind::Parallelogram:
+      ok = uint64_t(n.first) + 3 <= points;
+      break;
+    case Kind::Path:
+    case Kind::Segments:
+      ok = uint64_t(n.first) + n.second <= points && n.third < scalars
+        && (n.kind == Kind::Path || n.second % 2 == 0);
+      break;
+    case Kind::Image:
+      // Check the full-size level first.  Past that, the smaller levels
+      // add at most a few times as much again, and the pixel count is
+      // bounded by the file's size, so the sum can't overflow.
+      ok = n.first <= pixels
+        && uint64_t(n.second) * n.third <= pixels - n.first
+        && n.first + imagePixels(n.second, n.third,
+                                 n.sampling == ImageSampling::Mipmap)
+           <= pixels;
+      break;
+    case Kind::Transform:
+      ok = n.first < i && uint64_t(n.second) + 6 <= scalars;
+      break;
+    case Kind::Over:
+      ok = n.first < i && n.second < i;
+      break;
+    case Kind::Opacity:
+      ok = n.first < i && n.second < scalars;
+      break;
+    default:
+      ok = false;
+    }
+    if (!ok)
+      return false;
+  }
+  return true;
+}
+
+std::shared_ptr<PainterArena> PainterArena::load(const char *fname,
+                                                 PainterId* root) {
+  FILE *f = fopen(fname, "rb");
+  if (!f) {
+    fprintf(stderr, "failed to open %s: ", fname);
+    perror(NULL);
+    return nullptr;
+  }
+
+  std::shared_ptr<const void> file;
+  size_t size = 0;
+#ifdef HAVE_MMAP
+  struct stat st;
+  if (fstat(fileno(f), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    size = st.st_size;
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(f), 0);
+    if (data != MAP_FAILED)
+      file = std::shared_ptr<const void>(data, [size](const void* data) {
+        munmap(const_cast<void*>(data), size);
+      });
+  }
+#endif
+  if (!file) {
+    // Fall back to reading the whole file.  Allocations are aligned
+    // enough for the arrays.
+    auto data = std::make_shared<std::vector<uint8_t>>();
+    uint8_t buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+      data->insert(data->end(), buf, buf + n);
+    if (ferror(f)) {
+      fprintf(stderr, "failed to read %s: ", fname);
+      perror(NULL);
+      fclose(f);
+      return nullptr;
+    }
+    size = data->size();
+    file = std::shared_ptr<const void>(data, data->data());
+  }
+  fclose(f);
+
+  const uint8_t *bytes = static_cast<const uint8_t*>(file.get());
+  SceneHeader header;
+  if (size < sizeof(header)) {
+    fprintf(stderr, "%s is not a scene file\n", fname);
+    return nullptr;
+  }
+  memcpy(&header, bytes, sizeof(header));
+  if (memcmp(header.magic, kSceneMagic, sizeof(header.magic)) != 0) {
+    fprintf(stderr, "%s is not a scene file\n", fname);
+    return nullptr;
+  }
+  if (header.version != kSceneVersion
+      || header.byteOrder != kSceneByteOrder
+      || memcmp(header.sizes, kSceneSizes, sizeof(header.sizes)) != 0) {
+    fprintf(stderr, "%s is a scene file for a different version or build\n",
+            fname);
+    return nullptr;
+  }
+  bool ok = header.counts[0] == header.counts[1] && header.counts[0] > 0
+    && header.counts[0] <= UINT32_MAX && header.root < header.counts[0];
+  for (size_t i = 0; i < 5 && ok; i++) {
+    ok = header.offsets[i] % 8 == 0 && header.offsets[i] <= size
+      && header.counts[i] <= (size - header.offsets[i]) / kSceneSizes[i];
+  }
+  const Node *nodes = reinterpret_cast<const Node*>(bytes + header.offsets[0]);
+  if (!ok || !checkScene(header, nodes)) {
+    fprintf(stderr, "bad scene file %s\n", fname);
+    return nullptr;
+  }
+
+  auto ret = std::make_shared<PainterArena>();
+  ret->nodeData_ = nodes;
+  ret->boundsData_ =
+    reinterpret_cast<const Bounds*>(bytes + header.offsets[1]);
+  ret->pointData_ = reinterpret_cast<const Vector*>(bytes + header.offsets[2]);
+  ret->scalarData_ =
+    reinterpret_cast<const double*>(bytes + header.offsets[3]);
+  ret->pixelData_ = reinterpret_cast<const Color*>(bytes + header.offsets[4]);
+  ret->size_ = header.counts[0];
+  ret->pointCount_ = header.counts[2];
+  ret->scalarCount_ = header.counts[3];
+  ret->pixelCount_ = header.counts[4];
+  ret->file_ = std::move(file);
+  *root = header.root;
+  return ret;
+}
+
+bool saveScene(const char *fname, PainterPtr p) {
+  PainterArena arena;
+  PainterId root;
+  return arena.copy(p, &root) && arena.save(fname, root);
+}
+
+PainterPtr loadScene(const char *fname) {
+  PainterId root;
+  std::shared_ptr<PainterArena> arena = PainterArena::load(fname, &root);
+  if (!arena)
+    return nullptr;
+  return painter(arena, root);
+}
+
+static void collectNodes(const Painter* p,
+                         std::unordered_set<const Painter*>& seen) {
+  if (!seen.insert(p).second)
+    return;
+  if (auto t = dynamic_cast<const TransformPainter*>(p)) {
+    collectNodes(t->painter().get(), seen);
+  } else if (auto o = dynamic_cast<const OverPainter*>(p)) {
+    collectNodes(o->first().get(), seen);
+    collectNodes(o->second().get(), seen);
+  } else if (auto g = dynamic_cast<const GroupPainter*>(p)) {
+    for (const PainterPtr& child : g->painters())
+      collectNodes(child.get(), seen);
+  } else if (auto o = dynamic_cast<const OpacityPainter*>(p)) {
+    collectNodes(o->painter().get(), seen);
+  }
+}
+
+size_t countNodes(PainterPtr p) {
+  std::unordered_set<const Painter*> seen;
+  collectNodes(p.get(), seen);
+  return seen.size();
+}
+
+static bool isUnitSquareCorner(const Vector& v) {
+  return (v.x == 0 || v.x == 1) && (v.y == 0 || v.y == 1);
+}
+
+// Whether FRAME maps the unit square onto itself: an identity, rotation
+// or flip.
+static bool preservesUnitSquare(const Frame& frame) {
+  Vector c1 = frame.origin.add(frame.edge1);
+  Vector c2 = frame.origin.add(frame.edge2);
+  Vector c3 = c1.add(frame.edge2);
+  return isUnitSquareCorner(frame.origin) && isUnitSquareCorner(c1)
+    && isUnitSquareCorner(c2) && isUnitSquareCorner(c3)
+    && frame.edge1.magnitude() == 1 && frame.edge2.magnitude() == 1
+    && frame.edge1.x * frame.edge2.x + frame.edge1.y * frame.edge2.y == 0;
+}
+
+static bool isIdentity(const Frame& frame) {
+  return frame.origin.x == 0 && frame.origin.y == 0
+    && frame.edge1.x == 1 && frame.edge1.y == 0
+    && frame.edge2.x == 0 && frame.edge2.y == 1;
+}
+
+// Whether P paints every pixel of its frame, as color does.
+static bool coversFrame(const PainterPtr& p) {
+  if (auto t = dynamic_cast<const TransformPainter*>(p.get()))
+    return preservesUnitSquare(t->frame()) && coversFrame(t->painter());
+  auto q = dynamic_cast<const ParallelogramPainter*>(p.get());
+  // The parallelogram that color makes.
+  return q && preservesUnitSquare(Frame(q->origin(), q->edge1(), q->edge2()));
+}
+
+// Whether everything P paints is within its frame.
+static bool withinFrame(const PainterPtr& p) {
+  Bounds b = p->bounds();
+  return !b.isUnbounded() && b.pad == 0 && b.min.x >= 0 && b.min.y >= 0
+    && b.max.x <= 1 && b.max.y <= 1;
+}
+
+class Simplifier
+{
+private:
+  std::unordered_map<const Painter*, PainterPtr> memo_;
+
+  void flatten(const PainterPtr& p, std::vector<PainterPtr>& out) {
+    if (auto o = dynamic_cast<const OverPainter*>(p.get())) {
+      flatten(o->first(), out);
+      flatten(o->second(), out);
+      return;
+    }
+    if (auto g = dynamic_cast<const GroupPainter*>(p.get())) {
+      for (const PainterPtr& child : g->painters())
+        flatten(child, out);
+      return;
+    }
+    PainterPtr simplified = simplify(p);
+    // Nothing painted within the frame before an opaque fill of the
+    // whole frame shows.
+    if (coversFrame(simplified))
+      out.erase(std::remove_if(out.begin(), out.end(), withinFrame),
+                out.end());
+    out.push_back(simplified);
+  }
+
+  PainterPtr visit(const PainterPtr& p) {
+    if (auto t = dynamic_cast<const TransformPainter*>(p.get())) {
+      PainterPtr child = simplify(t->painter());
+      if (isIdentity(t->frame()))
+        return child;
+      if (auto inner = dynamic_cast<const TransformPainter*>(child.get()))
+        return PainterPtr(new TransformPainter(inner->painter(),
+                                               t->frame().project(inner->frame())));
+      if (child == t->painter())
+        return p;
+      return PainterPtr(new TransformPainter(child, t->frame()));
+    }
+    if (dynamic_cast<const OverPainter*>(p.get())
+        || dynamic_cast<const GroupPainter*>(p.get())) {
+      std::vector<PainterPtr> painters;
+      flatten(p, painters);
+      if (painters.size() == 1)
+        return painters[0];
+      return PainterPtr(new GroupPainter(std::move(painters)));
+    }
+    if (auto o = dynamic_cast<const OpacityPainter*>(p.get())) {
+      PainterPtr child = simplify(o->painter());
+      if (child == o->painter())
+        return p;
+      return PainterPtr(new OpacityPainter(child, o->alpha()));
+    }
+    return p;
+  }
+
+public:
+  PainterPtr simplify(const PainterPtr& p) {
+    auto it = memo_.find(p.get());
+    if (it != memo_.end())
+      return it->second;
+    PainterPtr ret = visit(p);
+    memo_.emplace(p.get(), ret);
+    return ret;
+  }
 };
 
-PainterPtr black() { return color(Color::black()); }
-PainterPtr gray() { return color(Color::gray()); }
-PainterPtr white() { return color(Color::white()); }
-PainterPtr blue() { return color(Color::blue()); }
-PainterPtr red() { return color(Color::red()); }
+PainterPtr simplify(PainterPtr p, SimplifyStats* stats) {
+  PainterPtr ret = Simplifier().simplify(p);
+  if (stats) {
+    stats->nodesBefore = countNodes(p);
+    stats->nodesAfter = countNodes(ret);
+  }
+  return ret;
+}
 
-// (define diagonal-shading (procedure->painter (λ (x y) (* 100 (+ x y)))))
-// (define einstein         (bitmap->painter einstein-file))
+DisplayList compile(PainterPtr p) {
+  DisplayList ret;
+  DrawingContext cx(ret);
+  p->paint(cx, Frame(Vector(0,0), Vector(1,0), Vector(0,1)));
+  return ret;
+}
 
 void paint(DrawingContext& cx, PainterPtr p) {
   cx.fill(Color::white());
   p->paint(cx, Frame(Vector(0,0), Vector(1,0), Vector(0,1)));
+  cx.flush();
+}
+
+// Tiles waiting to be painted, for paintParallel.  Each worker has its
+// own queue, pre-loaded with an interleaved share of the tiles.  A
+// worker pops tiles from the front of its own queue, and when that runs
+// dry, steals from the back of the others' queues, so that workers
+// whose tiles are cheap help out with the expensive ones.
+class TileQueues
+{
+private:
+  struct Queue
+  {
+    std::mutex lock;
+    std::deque<uint32_t> tiles;
+  };
+  std::vector<Queue> queues_;
+
+public:
+  TileQueues(uint32_t workers, uint32_t tiles) : queues_(workers) {
+    for (uint32_t tile = 0; tile < tiles; tile++)
+      queues_[tile % workers].tiles.push_back(tile);
+  }
+
+  bool pop(uint32_t worker, uint32_t& tile) {
+    {
+      Queue& own = queues_[worker];
+      std::lock_guard<std::mutex> guard(own.lock);
+      if (!own.tiles.empty()) {
+        tile = own.tiles.front();
+        own.tiles.pop_front();
+        return true;
+      }
+    }
+    for (size_t i = 1; i < queues_.size(); i++) {
+      Queue& victim = queues_[(worker + i) % queues_.size()];
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (!victim.tiles.empty()) {
+        tile = victim.tiles.back();
+        victim.tiles.pop_back();
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+// Emscripten can only start threads if built with pthread support.
+// Even then, threads run on a pool of workers made at startup, as a
+// blocked main thread can't wait for a new worker to load, so builds
+// with a pool define PICTIE_MAX_THREADS to its size.
+#if defined(__EMSCRIPTEN__) && !defined(__EMSCRIPTEN_PTHREADS__)
+static const uint32_t maxThreads = 1;
+#elif defined(PICTIE_MAX_THREADS)
+static const uint32_t maxThreads = PICTIE_MAX_THREADS;
+#else
+static const uint32_t maxThreads = UINT32_MAX;
+#endif
+
+uint32_t parallelism() {
+  return clamp(1U, std::thread::hardware_concurrency(), maxThreads);
+}
+
+// Call WORK(worker) for each of WORKERS workers, each on its own
+// thread, with worker zero on this one, and wait for them all.
+template<typename WorkFn>
+static void runWorkers(uint32_t workers, WorkFn work) {
+  std::vector<std::thread> helpers;
+  for (uint32_t worker = 1; worker < workers; worker++)
+    helpers.emplace_back(work, worker);
+  work(0);
+  for (std::thread& helper : helpers)
+    helper.join();
+}
+
+void paintParallel(DrawingContext& cx, PainterPtr p, uint32_t threads,
+                   uint32_t tileSize) {
+  const PixelRect& clip = cx.clip();
+  threads = threads == 0 ? parallelism() : min(threads, maxThreads);
+  // Tiles draw straight away, so draw anything queued first.
+  cx.flush();
+  // Backends get what is drawn in order, on one thread.
+  if (threads == 1 || clip.empty() || tileSize == 0 || cx.backend()) {
+    paint(cx, p);
+    return;
+  }
+
+  uint32_t columns = (clip.x1 - clip.x0 + tileSize - 1) / tileSize;
+  uint32_t rows = (clip.y1 - clip.y0 + tileSize - 1) / tileSize;
+  uint32_t workers = min(threads, columns * rows);
+  TileQueues queues(workers, columns * rows);
+
+  std::vector<RenderStats> stats(workers);
+  // Each worker records into a trace of its own, as traces aren't
+  // thread-safe.
+  std::vector<RenderTrace> traces;
+  for (uint32_t worker = 0; worker < workers; worker++)
+    traces.emplace_back(worker);
+  auto work = [&](uint32_t worker) {
+    uint32_t tile;
+    while (queues.pop(worker, tile)) {
+      uint32_t x0 = clip.x0 + (tile % columns) * tileSize;
+      uint32_t y0 = clip.y0 + (tile / columns) * tileSize;
+      DrawingContext tileContext(cx, PixelRect(x0, y0, x0 + tileSize,
+                                               y0 + tileSize));
+      if (cx.trace())
+        tileContext.setTrace(&traces[worker]);
+      paint(tileContext, p);
+      stats[worker].add(tileContext.stats());
+    }
+  };
+
+  runWorkers(workers, work);
+  for (const RenderStats& s : stats)
+    cx.stats().add(s);
+  if (cx.trace())
+    for (const RenderTrace& t : traces)
+      cx.trace()->append(t);
+}
+
+static bool sameVector(const Vector& a, const Vector& b) {
+  return a.x == b.x && a.y == b.y;
+}
+
+static bool sameVectors(const std::vector<Vector>& a,
+                        const std::vector<Vector>& b) {
+  return a.size() == b.size()
+    && std::equal(a.begin(), a.end(), b.begin(), sameVector);
+}
+
+static bool sameColor(const Color& a, const Color& b) {
+  return a.r == b.r && a.g == b.g && a.b == b.b;
+}
+
+static bool sameFrame(const Frame& a, const Frame& b) {
+  return sameVector(a.origin, b.origin) && sameVector(a.edge1, b.edge1)
+    && sameVector(a.edge2, b.edge2);
+}
+
+// Whether A and B are leaves that paint the same.
+static bool sameLeaf(const Painter* a, const Painter* b) {
+  if (auto x = dynamic_cast<const TrianglePainter*>(a)) {
+    auto y = dynamic_cast<const TrianglePainter*>(b);
+    return y && sameVector(x->a(), y->a()) && sameVector(x->b(), y->b())
+      && sameVector(x->c(), y->c()) && sameColor(x->color(), y->color());
+  }
+  if (auto x = dynamic_cast<const ParallelogramPainter*>(a)) {
+    auto y = dynamic_cast<const ParallelogramPainter*>(b);
+    return y && sameVector(x->origin(), y->origin())
+      && sameVector(x->edge1(), y->edge1())
+      && sameVector(x->edge2(), y->edge2())
+      && sameColor(x->color(), y->color());
+  }
+  if (auto x = dynamic_cast<const PathPainter*>(a)) {
+    auto y = dynamic_cast<const PathPainter*>(b);
+    return y && sameVectors(x->points(), y->points())
+      && sameColor(x->color(), y->color()) && x->width() == y->width()
+      && x->lineCapStyle() == y->lineCapStyle()
+      && x->widthScaling() == y->widthScaling()
+      && x->lineJoinStyle() == y->lineJoinStyle();
+  }
+  if (auto x = dynamic_cast<const SegmentsPainter*>(a)) {
+    auto y = dynamic_cast<const SegmentsPainter*>(b);
+    return y && sameVectors(x->endpoints(), y->endpoints())
+      && sameColor(x->color(), y->color()) && x->width() == y->width()
+      && x->lineCapStyle() == y->lineCapStyle()
+      && x->widthScaling() == y->widthScaling();
+  }
+  if (auto x = dynamic_cast<const ImagePainter*>(a)) {
+    auto y = dynamic_cast<const ImagePainter*>(b);
+    return y && x->width() == y->width() && x->height() == y->height()
+      && x->sampling() == y->sampling()
+      && !memcmp(x->pixels().data(), y->pixels().data(),
+                 x->pixels().size() * sizeof(Color));
+  }
+  return false;
+}
+
+// Walks two painter graphs side by side for damage, marking the tiles
+// of the clip that differ.
+class DamageFinder
+{
+private:
+  static const uint32_t kTileSize = 32;
+
+  const DrawingContext& cx_;
+  const PixelRect clip_;
+  const uint32_t columns_;
+  const uint32_t rows_;
+  std::vector<uint8_t> damaged_;
+  size_t count_;
+
+  bool full() const { return count_ == damaged_.size(); }
+
+  void mark(const PixelRect& rect) {
+    if (rect.empty())
+      return;
+    uint32_t c0 = (rect.x0 - clip_.x0) / kTileSize;
+    uint32_t c1 = (rect.x1 - clip_.x0 + kTileSize - 1) / kTileSize;
+    uint32_t r0 = (rect.y0 - clip_.y0) / kTileSize;
+    uint32_t r1 = (rect.y1 - clip_.y0 + kTileSize - 1) / kTileSize;
+    for (uint32_t row = r0; row < r1; row++) {
+      for (uint32_t col = c0; col < c1; col++) {
+        uint8_t& tile = damaged_[size_t(row) * columns_ + col];
+        count_ += !tile;
+        tile = 1;
+      }
+    }
+  }
+
+  void mark(const Bounds& bounds, const Frame& frame) {
+    mark(cx_.clipBounds(bounds, frame));
+  }
+
+  void visit(const PainterArena& arena, PainterId before, PainterId after,
+             const Frame& frame) {
+    if (before == after || full())
+      return;
+    const PainterArena::Node& b = arena.node(before);
+    const PainterArena::Node& a = arena.node(after);
+    if (a.kind == b.kind) {
+      switch (a.kind) {
+      case PainterArena::Kind::Transform: {
+        Frame f = arena.frame(a);
+        if (sameFrame(f, arena.frame(b))) {
+          visit(arena, b.first, a.first, frame.project(f));
+          return;
+        }
+        break;
+      }
+      case PainterArena::Kind::Over:
+        visit(arena, b.first, a.first, frame);
+        visit(arena, b.second, a.second, frame);
+        return;
+      case PainterArena::Kind::Opacity:
+        if (arena.scalarData_[a.second] == arena.scalarData_[b.second]) {
+          visit(arena, b.first, a.first, frame);
+          return;
+        }
+        break;
+      default:
+        break;
+      }
+    }
+    mark(arena.bounds(before), frame);
+    mark(arena.bounds(after), frame);
+  }
+
+public:
+  explicit DamageFinder(const DrawingContext& cx)
+    : cx_(cx), clip_(cx.clip()),
+      columns_(clip_.empty() ? 0 : (clip_.x1 - clip_.x0 + kTileSize - 1)
+               / kTileSize),
+      rows_(clip_.empty() ? 0 : (clip_.y1 - clip_.y0 + kTileSize - 1)
+            / kTileSize),
+      damaged_(size_t(columns_) * rows_), count_(0) {}
+
+  void markAll() { mark(clip_); }
+
+  void visit(const PainterPtr& before, const PainterPtr& after,
+             const Frame& frame) {
+    if (before == after || full())
+      return;
+    const Painter *b = before.get(), *a = after.get();
+    if (auto x = dynamic_cast<const TransformPainter*>(b)) {
+      auto y = dynamic_cast<const TransformPainter*>(a);
+      if (y && sameFrame(x->frame(), y->frame())) {
+        visit(x->painter(), y->painter(), frame.project(y->frame()));
+        return;
+      }
+    } else if (auto x = dynamic_cast<const OverPainter*>(b)) {
+      if (auto y = dynamic_cast<const OverPainter*>(a)) {
+        visit(x->first(), y->first(), frame);
+        visit(x->second(), y->second(), frame);
+        return;
+      }
+    } else if (auto x = dynamic_cast<const GroupPainter*>(b)) {
+      auto y = dynamic_cast<const GroupPainter*>(a);
+      if (y && x->painters().size() == y->painters().size()) {
+        for (size_t i = 0; i < x->painters().size(); i++)
+          visit(x->painters()[i], y->painters()[i], frame);
+        return;
+      }
+    } else if (auto x = dynamic_cast<const OpacityPainter*>(b)) {
+      auto y = dynamic_cast<const OpacityPainter*>(a);
+      if (y && x->alpha() == y->alpha()) {
+        visit(x->painter(), y->painter(), frame);
+        return;
+      }
+    } else if (auto x = dynamic_cast<const ArenaPainter*>(b)) {
+      auto y = dynamic_cast<const ArenaPainter*>(a);
+      if (y && &x->arena() == &y->arena()) {
+        visit(x->arena(), x->root(), y->root(), frame);
+        return;
+      }
+    } else if (sameLeaf(b, a)) {
+      return;
+    }
+    mark(b->bounds(), frame);
+    mark(a->bounds(), frame);
+  }
+
+  // The damaged tiles, as runs along each row of tiles, with runs that
+  // span the same columns in consecutive rows merged.
+  std::vector<PixelRect> rects() const {
+    std::vector<PixelRect> ret;
+    // The rects that reach the bottom of the row before.
+    std::vector<size_t> open, next;
+    for (uint32_t row = 0; row < rows_; row++) {
+      next.clear();
+      uint32_t y0 = clip_.y0 + row * kTileSize;
+      uint32_t y1 = min(y0 + kTileSize, clip_.y1);
+      for (uint32_t col = 0; col < columns_; ) {
+        if (!damaged_[size_t(row) * columns_ + col]) {
+          col++;
+          continue;
+        }
+        uint32_t end = col;
+        while (end < columns_ && damaged_[size_t(row) * columns_ + end])
+          end++;
+        uint32_t x0 = clip_.x0 + col * kTileSize;
+        uint32_t x1 = min(clip_.x0 + end * kTileSize, clip_.x1);
+        auto above = std::find_if(open.begin(), open.end(), [&](size_t i) {
+          return ret[i].x0 == x0 && ret[i].x1 == x1;
+        });
+        if (above != open.end()) {
+          ret[*above].y1 = y1;
+          next.push_back(*above);
+        } else {
+          next.push_back(ret.size());
+          ret.push_back(PixelRect(x0, y0, x1, y1));
+        }
+        col = end;
+      }
+      open.swap(next);
+    }
+    return ret;
+  }
+};
+
+std::vector<PixelRect> damage(const DrawingContext& cx, PainterPtr before,
+                              PainterPtr after) {
+  DamageFinder finder(cx);
+  if (before)
+    finder.visit(before, after, Frame(Vector(0,0), Vector(1,0), Vector(0,1)));
+  else
+    finder.markAll();
+  return finder.rects();
+}
+
+void repaint(DrawingContext& cx, PainterPtr before, PainterPtr after,
+             uint32_t threads) {
+  if (cx.backend()) {
+    paintParallel(cx, after, threads);
+    return;
+  }
+  cx.flush();
+  for (const PixelRect& rect : damage(cx, before, after)) {
+    DrawingContext view(cx, rect);
+    paintParallel(view, after, threads);
+    cx.stats().add(view.stats());
+  }
+}
+
+void DrawingContext::flush(uint32_t threads) {
+  if (!bins_ || bins_->empty())
+    return;
+  CommandBins& bins = *bins_;
+  uint32_t tiles = bins.columns() * bins.rows();
+  threads = threads == 0 ? parallelism() : min(threads, maxThreads);
+  uint32_t workers = max(1U, min(threads, tiles));
+  TileQueues queues(workers, tiles);
+
+  std::vector<RenderStats> stats(workers);
+  auto work = [&](uint32_t worker) {
+    uint32_t tile;
+    while (queues.pop(worker, tile)) {
+      const std::vector<uint32_t>& bin = bins.bin(tile);
+      if (bin.empty())
+        continue;
+      uint32_t x0 = (tile % bins.columns()) * bins.tileSize();
+      uint32_t y0 = (tile / bins.columns()) * bins.tileSize();
+      DrawingContext tileContext(*this,
+                                 PixelRect(x0, y0, x0 + bins.tileSize(),
+                                           y0 + bins.tileSize()));
+      for (uint32_t i : bin) {
+        const CommandBins::Command& c = bins.command(i);
+        switch (c.kind) {
+        case CommandBins::Kind::Triangle:
+          tileContext.drawCanvasTriangle(Vector(c.xs[0], c.ys[0]),
+                                         Vector(c.xs[1], c.ys[1]),
+                                         Vector(c.xs[2], c.ys[2]), c.color);
+          break;
+        case CommandBins::Kind::Quad:
+          tileContext.drawCanvasQuad(Vector(c.xs[0], c.ys[0]),
+                                     Vector(c.xs[1], c.ys[1]),
+                                     Vector(c.xs[2], c.ys[2]),
+                                     Vector(c.xs[3], c.ys[3]), c.color);
+          break;
+        case CommandBins::Kind::Image:
+          tileContext.drawCanvasPixels(c.pixelWidth, c.pixelHeight,
+                                       bins.pixels(c),
+                                       Vector(c.xs[0], c.ys[0]),
+                                       Vector(c.xs[1], c.ys[1]),
+                                       Vector(c.xs[2], c.ys[2]), c.sampling);
+          break;
+        }
+      }
+      stats[worker].add(tileContext.stats());
+    }
+  };
+
+  runWorkers(workers, work);
+  for (const RenderStats& s : stats)
+    stats_.add(s);
+  bins.reset(width_, height_);
+}
+
+PPMSink::PPMSink(const char* fname)
+  : fname_(fname), file_(nullptr), width_(0) {}
+
+PPMSink::~PPMSink() {
+  if (file_)
+    fclose(file_);
+}
+
+bool PPMSink::begin(uint32_t width, uint32_t height) {
+  file_ = fopen(fname_.c_str(), "wb");
+  if (!file_) {
+    fprintf(stderr, "failed to create %s: ", fname_.c_str());
+    perror(NULL);
+    return false;
+  }
+  width_ = width;
+  return fprintf(file_, "P6\n%u %u\n255\n", width, height) > 0;
+}
+
+bool PPMSink::writeRows(const Color* pixels, uint32_t rows) {
+  size_t count = size_t(width_) * rows;
+  if (fwrite(pixels, sizeof(Color), count, file_) != count) {
+    perror("writing PPM file failed");
+    return false;
+  }
+  return true;
+}
+
+bool PPMSink::finish() {
+  int err = fclose(file_);
+  file_ = nullptr;
+  if (err != 0) {
+    perror("writing PPM file failed");
+    return false;
+  }
+  return true;
+}
+
+struct CRC32Table
+{
+  uint32_t entries[256];
+
+  CRC32Table() {
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t c = n;
+      for (int k = 0; k < 8; k++)
+        c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      entries[n] = c;
+    }
+  }
+};
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t size) {
+  // Initialized once, safely, whichever thread gets here first.
+  static const CRC32Table table;
+  crc = ~crc;
+  for (size_t i = 0; i < size; i++)
+    crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
+
+static uint32_t adler32(uint32_t adler, const uint8_t* data, size_t size) {
+  uint32_t a = adler & 0xffff, b = adler >> 16;
+  for (size_t i = 0; i < size; i++) {
+    a = (a + data[i]) % 65521;
+    b = (b + a) % 65521;
+  }
+  return (b << 16) | a;
+}
+
+static void putBigEndian32(uint8_t* out, uint32_t x) {
+  out[0] = x >> 24; out[1] = x >> 16; out[2] = x >> 8; out[3] = x;
+}
+
+PNGSink::PNGSink(const char* fname)
+  : fname_(fname), file_(nullptr), width_(0), adler_(1) {}
+
+PNGSink::~PNGSink() {
+  if (file_)
+    fclose(file_);
+}
+
+bool PNGSink::writeChunk(const char* type, const uint8_t* data, size_t size) {
+  uint8_t header[8];
+  putBigEndian32(header, size);
+  memcpy(header + 4, type, 4);
+  uint32_t crc = crc32(crc32(0, header + 4, 4), data, size);
+  uint8_t trailer[4];
+  putBigEndian32(trailer, crc);
+  if (fwrite(header, 1, 8, file_) != 8
+      || fwrite(data, 1, size, file_) != size
+      || fwrite(trailer, 1, 4, file_) != 4) {
+    perror("writing PNG file failed");
+    return false;
+  }
+  return true;
+}
+
+bool PNGSink::begin(uint32_t width, uint32_t height) {
+  file_ = fopen(fname_.c_str(), "wb");
+  if (!file_) {
+    fprintf(stderr, "failed to create %s: ", fname_.c_str());
+    perror(NULL);
+    return false;
+  }
+  width_ = width;
+  adler_ = 1;
+  static const uint8_t signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+  uint8_t ihdr[13];
+  putBigEndian32(ihdr, width);
+  putBigEndian32(ihdr + 4, height);
+  ihdr[8] = 8;  // Bit depth.
+  ihdr[9] = 2;  // Truecolor.
+  ihdr[10] = ihdr[11] = ihdr[12] = 0;
+  // The zlib header: deflate with a 32K window, no preset dictionary.
+  static const uint8_t zlibHeader[2] = { 0x78, 0x01 };
+  if (fwrite(signature, 1, 8, file_) != 8) {
+    perror("writing PNG file failed");
+    return false;
+  }
+  return writeChunk("IHDR", ihdr, sizeof(ihdr))
+    && writeChunk("IDAT", zlibHeader, sizeof(zlibHeader));
+}
+
+bool PNGSink::writeRows(const Color* pixels, uint32_t rows) {
+  // Each row is a filter type byte, 0 for none, and then the pixels.
+  size_t rowBytes = 1 + size_t(width_) * sizeof(Color);
+  std::vector<uint8_t> raw(rowBytes * rows);
+  for (uint32_t y = 0; y < rows; y++) {
+    raw[y * rowBytes] = 0;
+    memcpy(&raw[y * rowBytes + 1], pixels + size_t(y) * width_,
+           rowBytes - 1);
+  }
+  adler_ = adler32(adler_, raw.data(), raw.size());
+
+  // Wrap the rows in non-final stored blocks of at most 65535 bytes.
+  std::vector<uint8_t> deflated;
+  deflated.reserve(raw.size() + (raw.size() / 65535 + 1) * 5);
+  for (size_t pos = 0; pos < raw.size(); pos += 65535) {
+    uint16_t len = min(raw.size() - pos, size_t(65535));
+    uint8_t header[5] = { 0, uint8_t(len), uint8_t(len >> 8),
+                          uint8_t(~len), uint8_t(~len >> 8) };
+    deflated.insert(deflated.end(), header, header + 5);
+    deflated.insert(deflated.end(), &raw[pos], &raw[pos] + len);
+  }
+  return writeChunk("IDAT", deflated.data(), deflated.size());
+}
+
+bool PNGSink::finish() {
+  // An empty final stored block, then the checksum.
+  uint8_t tail[9] = { 1, 0, 0, 0xff, 0xff };
+  putBigEndian32(tail + 5, adler_);
+  bool ok = writeChunk("IDAT", tail, sizeof(tail))
+    && writeChunk("IEND", nullptr, 0);
+  int err = fclose(file_);
+  file_ = nullptr;
+  if (ok && err != 0) {
+    perror("writing PNG file failed");
+    return false;
+  }
+  return ok;
+}
+
+bool paintBands(PainterPtr p, uint32_t width, uint32_t height,
+                ImageSink& sink, uint32_t bandHeight, uint32_t threads) {
+  if (bandHeight == 0 || !sink.begin(width, height))
+    return false;
+  for (uint32_t y = 0; y < height; y += bandHeight) {
+    uint32_t rows = min(bandHeight, height - y);
+    DrawingContext band(width, height, y, rows);
+    paintParallel(band, p, threads);
+    // The band stores just its rows, so they can be written in place.
+    if (!sink.writeRows(band.pixelRow(y), rows))
+      return false;
+  }
+  return sink.finish();
 }
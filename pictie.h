@@ -1,7 +1,13 @@
+#ifndef PICTIE_H
+#define PICTIE_H
+
 #include <math.h>
 #include <stdint.h>
 
+#include <map>
 #include <memory>
+#include <mutex>
+#include <string>
 #include <vector>
 
 class Vector
@@ -74,8 +80,205 @@ struct Color
   static Color red() { return Color(200, 10, 10); }
 };
 
-enum class LineCapStyle { Butt, Square };
-enum class LineWidthScaling { Scaled, Unscaled };
+// A conservative bounding box of what a painter paints, in the unit
+// space of the frame it paints into.  PAD is extra margin in the unit
+// space of the canvas, for line widths that don't scale with the frame.
+struct Bounds
+{
+  Vector min;
+  Vector max;
+  double pad;
+
+  Bounds(const Vector& min, const Vector& max, double pad = 0)
+    : min(min), max(max), pad(pad) {}
+
+  static Bounds unbounded() {
+    return Bounds(Vector(-HUGE_VAL, -HUGE_VAL), Vector(HUGE_VAL, HUGE_VAL));
+  }
+  static Bounds of(const Vector* points, size_t count, double pad = 0);
+  static Bounds of(const std::vector<Vector>& points, double pad = 0) {
+    return of(points.data(), points.size(), pad);
+  }
+
+  bool isUnbounded() const { return min.x == -HUGE_VAL; }
+  Bounds join(const Bounds& other) const;
+  Bounds project(const Frame& frame) const;
+};
+
+// A rectangle of pixels, including X0 and Y0 but not X1 and Y1.
+struct PixelRect
+{
+  uint32_t x0;
+  uint32_t y0;
+  uint32_t x1;
+  uint32_t y1;
+
+  PixelRect(uint32_t x0, uint32_t y0, uint32_t x1, uint32_t y1)
+    : x0(x0), y0(y0), x1(x1), y1(y1) {}
+
+  bool empty() const { return x0 >= x1 || y0 >= y1; }
+};
+
+// These enums are a byte each, so that the arena's nodes stay small.
+enum class LineCapStyle : uint8_t { Butt, Square };
+enum class LineWidthScaling : uint8_t { Scaled, Unscaled };
+// How the segments of a path meet.  With None, each segment is drawn
+// as a separate line, which leaves a notch on the outside of each turn.
+// Miter extends the outer edges until they meet, falling back to Bevel
+// for turns sharp enough to put the point more than four half-widths,
+// or twice the line width, from the corner; Bevel cuts the corner off;
+// Round rounds it.
+enum class LineJoinStyle : uint8_t { None, Miter, Bevel, Round };
+// How images are sampled when drawn.  Nearest takes the source pixel
+// under each destination pixel's center, Bilinear blends the four
+// nearest source pixels, and Mipmap samples bilinearly from a
+// box-filtered copy of the image no more than twice the destination
+// size, so that downscaled images don't alias.
+enum class ImageSampling : uint8_t { Nearest, Bilinear, Mipmap };
+
+class CommandBins;
+class DisplayList;
+class OcclusionMask;
+class Painter;
+template<typename Pixel> class Surface;
+class RenderBackend;
+class RenderCache;
+
+// Counts of the work that a context has done, for benchmarks and
+// profiling.  Builds with PICTIE_NO_STATS defined don't count anything,
+// and leave these at zero.
+struct RenderStats
+{
+  // Calls to Painter::paint, and those that were transforms.
+  uint64_t painters = 0;
+  uint64_t transforms = 0;
+  // Subtrees skipped because they were out of the clip or too small.
+  uint64_t culled = 0;
+  // Primitives that reached the rasterizer, and those skipped because
+  // everything under them was already final, when replaying front to
+  // back.
+  uint64_t triangles = 0;
+  uint64_t quads = 0;
+  uint64_t images = 0;
+  uint64_t occluded = 0;
+  // Pixels in the clipped bounding boxes of those primitives, pixels
+  // whose centers or samples were checked against their edges, and
+  // pixels that they covered.  In fixed-point mode, the span of each
+  // row is solved for without testing pixels, so none are tested.
+  uint64_t boundingBoxPixels = 0;
+  uint64_t pixelsTested = 0;
+  uint64_t pixelsCovered = 0;
+  // Pixels that were stored to, including by fills and cache copies.
+  uint64_t pixelsWritten = 0;
+
+  void add(const RenderStats& other) {
+    painters += other.painters;
+    transforms += other.transforms;
+    culled += other.culled;
+    triangles += other.triangles;
+    quads += other.quads;
+    images += other.images;
+    occluded += other.occluded;
+    boundingBoxPixels += other.boundingBoxPixels;
+    pixelsTested += other.pixelsTested;
+    pixelsCovered += other.pixelsCovered;
+    pixelsWritten += other.pixelsWritten;
+  }
+
+  // The fraction of bounding box pixels that primitives covered.  Low
+  // values mean thin or diagonal shapes, which waste rasterizer setup.
+  double boundingBoxEfficiency() const {
+    return boundingBoxPixels ? double(pixelsCovered) / boundingBoxPixels : 1.0;
+  }
+};
+
+// A timeline of the painters that were painted, for profiling.  Each
+// event covers one call to Painter::paint, including the painters that
+// it called in turn, so the events nest like the painter tree.  Can be
+// written out in the Chrome trace event format, which chrome://tracing
+// and ui.perfetto.dev load.  Builds with PICTIE_NO_STATS defined don't
+// record anything.
+class RenderTrace
+{
+public:
+  struct Event
+  {
+    // A static string, such as "transform".
+    const char *name;
+    // Which of paintParallel's workers painted it.
+    uint32_t thread;
+    uint32_t depth;
+    // Nanoseconds on the steady clock.
+    int64_t start;
+    int64_t duration;
+  };
+
+private:
+  uint32_t thread_;
+  uint32_t depth_;
+  std::vector<Event> events_;
+
+public:
+  explicit RenderTrace(uint32_t thread = 0) : thread_(thread), depth_(0) {}
+
+  static int64_t now();
+
+  size_t size() const { return events_.size(); }
+  const std::vector<Event>& events() const { return events_; }
+  void clear() { events_.clear(); }
+
+  // Start an event, returning its start time, and finish it.  Events
+  // must be finished in the reverse order that they were started.
+  int64_t begin() { depth_++; return now(); }
+  void end(const char *name, int64_t start);
+  // Add the events of OTHER, such as those of a worker thread.
+  void append(const RenderTrace& other);
+
+  // The events as Chrome trace JSON, with times relative to the first.
+  std::string toJSON() const;
+  bool write(const char *fname) const;
+};
+
+// Where a DrawingContext made with one sends what painters draw,
+// instead of rasterizing it.  Coordinates are in the unit square of the
+// canvas, with y going up, after all of the painters' frames.  Lines and
+// images that a backend doesn't take come as the triangles and quads
+// that the rasterizer would have drawn.
+class RenderBackend
+{
+public:
+  virtual ~RenderBackend() {}
+
+  // Fill the whole canvas.
+  virtual void fill(const Color& color) {}
+  virtual void drawTriangle(const Vector& a, const Vector& b,
+                            const Vector& c, const Color& color) = 0;
+  virtual void drawQuad(const Vector& a, const Vector& b, const Vector& c,
+                        const Vector& d, const Color& color) = 0;
+  // Take a stroke through the COUNT points, as for
+  // DrawingContext::drawPolyline, and return true, or return false to
+  // get it as triangles and quads.  Single lines come as two points,
+  // joined with None.
+  virtual bool drawPolyline(const Vector* points, size_t count,
+                            const Color& color, double width,
+                            LineCapStyle lineCapStyle,
+                            LineJoinStyle lineJoinStyle) {
+    return false;
+  }
+  // Likewise for DrawingContext::drawPixels.  Images that aren't taken
+  // come as a quad per source pixel.
+  virtual bool drawPixels(uint32_t pixelWidth, uint32_t pixelHeight,
+                          const Color* pixels, const Vector& origin,
+                          const Vector& edge1, const Vector& edge2,
+                          ImageSampling sampling) {
+    return false;
+  }
+  // What is drawn between these is blended into what is below it at
+  // opacity ALPHA, from 0 to 1.  They nest.  By default they do
+  // nothing, so that translucent painters are drawn opaque.
+  virtual void beginOpacity(double alpha) {}
+  virtual void endOpacity() {}
+};
 
 class DrawingContext
 {
@@ -83,14 +286,164 @@ private:
   uint32_t width_;
   uint32_t height_;
   const Frame canvasFrame_;
-  std::vector<Color> pixels_;
+  std::vector<Color> storage_;
+  // Pixel (x, y) is at pixels_[(y - firstRow_) * stride_ + x].  If
+  // coverage_ is set, the corresponding byte there is set to 1 when the
+  // pixel is drawn.
+  Color *pixels_;
+  uint32_t stride_;
+  uint32_t firstRow_;
+  uint8_t *coverage_;
+  const PixelRect clip_;
+  double cullThreshold_;
+  bool antialias_;
+  bool fixedPoint_;
+  // Set when a translucent painter has been blended into this context.
+  bool translucent_;
+  // Scratch space for fillConvexAntialiased.
+  std::vector<int8_t> coverageDeltas_;
+  mutable RenderStats stats_;
+  RenderTrace *trace_;
+  CommandBins *bins_;
+  // If set, pixels that the mask says are final are left alone, and
+  // primitives over only such pixels aren't rasterized.
+  OcclusionMask *occlusion_;
+  // If set, what is drawn goes here instead of to the pixels.
+  RenderBackend *backend_;
+  RenderCache *cache_;
+  std::vector<uint8_t> rgba_;
+
+  // A context like PARENT, drawing within CLIP into PIXELS and, if not
+  // null, COVERAGE.  Those hold the rows of CLIP, from column zero, with
+  // STRIDE pixels per row.
+  DrawingContext(const DrawingContext& parent, const PixelRect& clip,
+                 uint32_t stride, Color* pixels, uint8_t* coverage);
+
+  template<typename Pixel> friend class Surface;
+  friend class DisplayList;
+
+  Color* row(uint32_t y) { return pixels_ + size_t(y - firstRow_) * stride_; }
+  const Color* row(uint32_t y) const {
+    return pixels_ + size_t(y - firstRow_) * stride_;
+  }
+  void fillSpan(uint32_t y, uint32_t x0, uint32_t x1, const Color& color);
+  template<size_t N, typename SpanFn>
+  void forEachSpan(const Vector (&points)[N], SpanFn span);
+  template<size_t N>
+  void fillConvex(const Vector (&points)[N], const Color& color);
+  template<size_t N>
+  void fillConvexAntialiased(const Vector (&points)[N], const Color& color);
+  template<size_t N>
+  void fillConvexFixed(const Vector (&points)[N], const Color& color);
+  void drawJoin(const Vector& p, const Vector& in, const Vector& out,
+                double halfWidth, LineJoinStyle lineJoinStyle,
+                const Color& color);
+  // The draw methods, after projection onto the canvas.
+  void drawCanvasTriangle(Vector a, Vector b, Vector c, const Color& color);
+  void drawCanvasQuad(const Vector& a, const Vector& b, const Vector& c,
+                      const Vector& d, const Color& color);
+  void drawCanvasPixels(uint32_t pixelWidth, uint32_t pixelHeight,
+                        const Color* pixels, const Vector& origin,
+                        const Vector& edge1, const Vector& edge2,
+                        ImageSampling sampling);
 
 public:
   DrawingContext(uint32_t resolution);
+  DrawingContext(uint32_t width, uint32_t height);
+  // A context for a canvas of WIDTH by HEIGHT pixels that only stores
+  // and draws ROWCOUNT rows, starting at FIRSTROW.
+  DrawingContext(uint32_t width, uint32_t height, uint32_t firstRow,
+                 uint32_t rowCount);
+  // A view of PARENT's pixels, which only draws within CLIP.
+  DrawingContext(DrawingContext& parent, const PixelRect& clip);
+  // A context that sends what is drawn to BACKEND, instead of
+  // rasterizing it.  If WIDTH and HEIGHT are given, painters cull and
+  // pick the detail of curves and images for a canvas that size;
+  // otherwise what BACKEND gets is good for any size.
+  explicit DrawingContext(RenderBackend& backend, uint32_t width = 0,
+                          uint32_t height = 0);
+  DrawingContext(const DrawingContext&) = delete;
+  DrawingContext& operator=(const DrawingContext&) = delete;
   
   uint32_t width() const { return width_; };
   uint32_t height() const { return height_; };
+  const PixelRect& clip() const { return clip_; }
+  uint32_t firstRow() const { return firstRow_; }
+  // Row Y of the pixels, which must be within the clip rectangle, for
+  // reading in place.  Rows are stride() pixels apart.
+  const Color* pixelRow(uint32_t y) const { return row(y); }
+  uint32_t stride() const { return stride_; }
+  RenderBackend* backend() const { return backend_; }
 
+  // Painters skip painting subtrees whose bounds, projected through
+  // FRAME, miss the clip rectangle.  Subtrees whose projection is
+  // smaller than the cull threshold in both dimensions are skipped as
+  // well; the default threshold of zero never skips anything visible.
+  bool culls(const Bounds& bounds, const Frame& frame) const;
+  // The pixels of the clip rectangle that a painter with BOUNDS might
+  // touch when painted into FRAME.
+  PixelRect clipBounds(const Bounds& bounds, const Frame& frame) const;
+  double cullThreshold() const { return cullThreshold_; }
+  void setCullThreshold(double pixels) { cullThreshold_ = pixels; }
+
+  // When antialiasing, triangles, quads and lines are sampled at eight
+  // points per pixel, and blended into the canvas by the fraction of
+  // points that they cover.  Otherwise a pixel is drawn if its center
+  // is covered.  The render cache is only used without antialiasing.
+  bool antialiasing() const { return antialias_; }
+  void setAntialiasing(bool antialias) { antialias_ = antialias; }
+
+  // In fixed-point mode, the vertices of triangles, quads and lines are
+  // snapped to 1/256 of a pixel once projected onto the canvas, and
+  // their coverage is computed with integer arithmetic alone.  Pixels
+  // whose centers lie exactly on an edge shared by two primitives are
+  // drawn by one of them, never both or neither, and the result doesn't
+  // depend on the floating-point behavior of the build.  Antialiasing
+  // takes precedence.
+  bool fixedPoint() const { return fixedPoint_; }
+  void setFixedPoint(bool fixedPoint) { fixedPoint_ = fixedPoint; }
+
+  // If a render cache is set, painters that are shared between several
+  // parents are rasterized once per size and copied when painted again
+  // into an axis-aligned, pixel-aligned frame.  Returns true if PAINTER
+  // was painted into FRAME in that way.
+  RenderCache* renderCache() const { return cache_; }
+  void setRenderCache(RenderCache* cache) { cache_ = cache; }
+  bool paintCached(const std::shared_ptr<const Painter>& painter,
+                   const Frame& frame);
+
+  // Paint PAINTER into FRAME at opacity ALPHA, from 0 to 1: paint it
+  // into a copy of the pixels under its bounds, and blend that copy
+  // back in.  Backends that have no use for opacity get PAINTER opaque.
+  void paintTranslucent(const Painter& painter, const Frame& frame,
+                        double alpha);
+
+  // What this context has drawn.  paintParallel adds in what its tiles
+  // drew.
+  const RenderStats& stats() const { return stats_; }
+  RenderStats& stats() { return stats_; }
+  void resetStats() { stats_ = RenderStats(); }
+
+  // If a trace is set, painters record an event in it for each call to
+  // paint.  paintParallel appends the events of each of its threads.
+  RenderTrace* trace() const { return trace_; }
+  void setTrace(RenderTrace* trace) { trace_ = trace; }
+
+  // If bins are set, triangles, quads, lines and images are projected
+  // onto the canvas and queued in the bins of the tiles that they
+  // touch, instead of being drawn straight away.  flush draws the
+  // queue of each tile in turn, in the order that things were drawn,
+  // on THREADS threads, or one per core if THREADS is zero.  Painting
+  // a scene with many small primitives spread over a large canvas then
+  // touches each tile's pixels while they are in cache, instead of
+  // going back and forth all over the canvas.  fill, paintTranslucent,
+  // writePPM, getPixels, getRGBA, paint and Surface::composite all
+  // flush first; the render cache isn't used while binning.
+  CommandBins* bins() const { return bins_; }
+  void setBins(CommandBins* bins);
+  void flush(uint32_t threads = 1);
+
+  // Fill the clip rectangle, or for backends, the whole canvas.
   void fill(const Color& color);
 
   void drawTriangle(const Vector& a, const Vector &b, const Vector &c,
@@ -99,14 +452,363 @@ public:
                 const Vector& d, const Color& color);
   void drawLine(const Vector& a, const Vector &b, const Color& color,
                 double width, LineCapStyle lineCapStyle);
+  // Draw the COUNT points as one stroke, capped at the two ends and
+  // joined at the others.
+  void drawPolyline(const Vector* points, size_t count, const Color& color,
+                    double width, LineCapStyle lineCapStyle,
+                    LineJoinStyle lineJoinStyle);
+  // Draw an image into the parallelogram given by ORIGIN, EDGE1 and
+  // EDGE2, with the first row of PIXELS at the far end of EDGE2.  Each
+  // destination pixel is mapped back into the image and sampled, so the
+  // cost is proportional to the destination area.  Mipmap sampling is
+  // the same as Bilinear here; ImagePainter picks the level to draw.
   void drawPixels(uint32_t pixelWidth, uint32_t pixelHeight, const Color* pixels,
-                  const Vector& origin, const Vector& edge1, const Vector& edge2);
+                  const Vector& origin, const Vector& edge1, const Vector& edge2,
+                  ImageSampling sampling = ImageSampling::Nearest);
 
+  // These cover the clip rectangle, which for contexts that store
+  // their own pixels is the rows that they store, and for views is what
+  // they view.  Contexts with a backend have no pixels: writePPM fails,
+  // and the others are empty.
   bool writePPM(const char *fname);
-
-  std::vector<Color> getPixels() const;
+  std::vector<Color> getPixels();
+  // The pixels as RGBA bytes with opaque alpha, ready for a canvas
+  // ImageData.  The buffer belongs to the context, and is overwritten
+  // by the next call.
+  const std::vector<uint8_t>& getRGBA();
 };
   
+// Premultiplied RGBA pixel formats for Surface.  RGBA16F holds IEEE
+// half-precision floats.
+struct RGBA8
+{
+  uint8_t r, g, b, a;
+};
+
+struct RGBA16F
+{
+  uint16_t r, g, b, a;
+};
+
+struct RGBAF32
+{
+  float r, g, b, a;
+};
+
+// An image in one of the formats above, for layering the output of
+// several drawing contexts with alpha.  Where DrawingContext is opaque
+// 8-bit RGB, so that painting is fast, surfaces have an alpha channel,
+// and the float formats keep the precision that blending many layers
+// needs.  A surface starts out transparent.
+template<typename Pixel>
+class Surface
+{
+private:
+  uint32_t width_;
+  uint32_t height_;
+  std::vector<Pixel> pixels_;
+
+public:
+  Surface(uint32_t width, uint32_t height);
+
+  uint32_t width() const { return width_; }
+  uint32_t height() const { return height_; }
+  const std::vector<Pixel>& pixels() const { return pixels_; }
+
+  // Blend CX's clip rectangle, which is the rows that it stores if it
+  // isn't a view, over the same pixels of this surface, at opacity
+  // ALPHA, after flushing its bins.  RGBA8 surfaces round ALPHA to
+  // 1/256, as paintTranslucent does.  Returns false if CX is a
+  // different size.
+  bool composite(DrawingContext& cx, double alpha = 1.0);
+  // The surface over an opaque BACKGROUND, as 8-bit RGB.
+  std::vector<Color> flatten(const Color& background) const;
+  // Write the surface over black as a PFM, which keeps the float
+  // values, or return false on error.
+  bool writePFM(const char *fname) const;
+};
+
+// The triangles and quads that a painter draws, flattened into arrays
+// of vertices in the unit space of the canvas, along with the groups
+// of them that translucent painters draw.  Replaying a display list
+// into a context gives the same pixels as painting the painter it was
+// compiled from, at any resolution, without walking the painter again,
+// except that images become a quad per source pixel, which is Nearest
+// sampling.  A display list is the backend that compile draws into.
+class DisplayList : public RenderBackend
+{
+private:
+  // Struct-of-arrays: the vertices of all polygons, in order, and for
+  // each polygon its number of vertices and color.  A group drawn at an
+  // opacity starts with a BeginOpacity entry in sides_, whose alpha is
+  // the next in alphas_, and ends with an EndOpacity entry; those have
+  // no vertices, and an unused color.
+  enum : uint8_t { EndOpacity = 0, BeginOpacity = 1 };
+  std::vector<double> xs_;
+  std::vector<double> ys_;
+  std::vector<uint8_t> sides_;
+  std::vector<Color> colors_;
+  std::vector<double> alphas_;
+
+  // Where replay is up to in each of the arrays.
+  struct Cursor
+  {
+    size_t entry = 0;
+    size_t vertex = 0;
+    size_t alpha = 0;
+  };
+
+  // Replay from AT to the end of the group that it is in, or of the
+  // list, leaving AT after it.
+  void replayGroup(DrawingContext& cx, Cursor& at) const;
+  // Skip AT over the rest of the group that it is in.
+  void skipGroup(Cursor& at) const;
+  friend class DisplayListGroup;
+
+  // Draw the polygons last to first with an occlusion mask, then fill
+  // BACKGROUND, if any, where nothing was drawn.  Returns false if CX
+  // can't draw front to back, or if the list has translucent groups.
+  bool drawFrontToBack(DrawingContext& cx, const Color* background) const;
+
+public:
+  // The number of polygons.
+  size_t size() const { return sides_.size() - 2 * alphas_.size(); }
+
+  void drawTriangle(const Vector& a, const Vector& b, const Vector& c,
+                    const Color& color);
+  void drawQuad(const Vector& a, const Vector& b, const Vector& c,
+                const Vector& d, const Color& color);
+  void beginOpacity(double alpha);
+  void endOpacity();
+
+  // Translucent groups are replayed through
+  // DrawingContext::paintTranslucent, as painting them would.
+  void replay(DrawingContext& cx) const;
+  // Like paint: fill with white, then replay.
+  void paint(DrawingContext& cx) const;
+
+  // Like replay, but drawing the last polygon first, and never drawing
+  // over a pixel again once it has been drawn.  Polygons over 32 by 32
+  // pixel tiles that are all drawn already are skipped without
+  // rasterizing them.  The result is the same as replay's.  This pays
+  // off when opaque layers cover one another, as in scenes stacked over
+  // full backgrounds; for scenes of thin lines, keeping track of which
+  // pixels are drawn costs more than drawing them twice.  Antialiased
+  // and translucent blending depend on the order, so when antialiasing,
+  // or when the list has translucent groups, this just replays, as it
+  // does into backends or while binning.
+  void replayFrontToBack(DrawingContext& cx) const;
+  // Like paint, but replaying front to back and then filling only what
+  // is left.
+  void paintFrontToBack(DrawingContext& cx) const;
+};
+
+// A backend that counts what it is sent and draws nothing, for timing
+// the walk over the painters and the making of their geometry apart
+// from rasterization.  Lines come as the triangles and quads that they
+// are made of, but images are counted whole.
+class CountingBackend : public RenderBackend
+{
+public:
+  uint64_t fills = 0;
+  uint64_t triangles = 0;
+  uint64_t quads = 0;
+  uint64_t images = 0;
+
+  void reset() { fills = triangles = quads = images = 0; }
+
+  void fill(const Color& color) { fills++; }
+  void drawTriangle(const Vector& a, const Vector& b, const Vector& c,
+                    const Color& color) { triangles++; }
+  void drawQuad(const Vector& a, const Vector& b, const Vector& c,
+                const Vector& d, const Color& color) { quads++; }
+  bool drawPixels(uint32_t pixelWidth, uint32_t pixelHeight,
+                  const Color* pixels, const Vector& origin,
+                  const Vector& edge1, const Vector& edge2,
+                  ImageSampling sampling) {
+    images++;
+    return true;
+  }
+};
+
+// A backend that writes what is drawn as an SVG image WIDTH by HEIGHT
+// pixels.  Lines become strokes with the same caps and joins, triangles
+// and quads become polygons, and translucent painters become groups
+// with an opacity, so the picture is sharp at any size and the file
+// doesn't grow with it.  Images become a square per source pixel, which
+// is Nearest sampling.  Viewers antialias each polygon on its own, so
+// faint seams can show where polygons meet.
+class SVGBackend : public RenderBackend
+{
+private:
+  uint32_t width_;
+  uint32_t height_;
+  uint32_t depth_;
+  std::string body_;
+
+public:
+  SVGBackend(uint32_t width, uint32_t height)
+    : width_(width), height_(height), depth_(0) {}
+
+  uint32_t width() const { return width_; }
+  uint32_t height() const { return height_; }
+  void clear() { body_.clear(); }
+
+  // A fill covers everything drawn before it, so outside of opacity
+  // groups it starts the picture over.
+  void fill(const Color& color);
+  void drawTriangle(const Vector& a, const Vector& b, const Vector& c,
+                    const Color& color);
+  void drawQuad(const Vector& a, const Vector& b, const Vector& c,
+                const Vector& d, const Color& color);
+  bool drawPolyline(const Vector* points, size_t count, const Color& color,
+                    double width, LineCapStyle lineCapStyle,
+                    LineJoinStyle lineJoinStyle);
+  void beginOpacity(double alpha);
+  void endOpacity();
+
+  std::string toSVG() const;
+  bool write(const char *fname) const;
+};
+
+// Draw commands in canvas coordinates, kept in order and filed into a
+// bin for each square tile of the canvas that they touch, for
+// DrawingContext::setBins.  Each command is stored once; bins hold the
+// indices of their commands.  Images are copied in, so that they needn't
+// outlive the painters that drew them.
+class CommandBins
+{
+public:
+  enum class Kind : uint8_t { Triangle, Quad, Image };
+
+  struct Command
+  {
+    Kind kind;
+    ImageSampling sampling;
+    Color color;
+    // Image: its size in pixels.
+    uint32_t pixelWidth;
+    uint32_t pixelHeight;
+    // Image: index of its first pixel, for pixels.
+    size_t firstPixel;
+    // Triangle, Quad: the vertices.  Image: the origin, then the two
+    // edge vectors.
+    double xs[4];
+    double ys[4];
+  };
+
+private:
+  const uint32_t tileSize_;
+  uint32_t columns_;
+  uint32_t rows_;
+  std::vector<Command> commands_;
+  std::vector<std::vector<uint32_t>> bins_;
+  std::vector<Color> pixels_;
+
+public:
+  explicit CommandBins(uint32_t tileSize = 64)
+    : tileSize_(tileSize ? tileSize : 64), columns_(0), rows_(0) {}
+
+  uint32_t tileSize() const { return tileSize_; }
+  uint32_t columns() const { return columns_; }
+  uint32_t rows() const { return rows_; }
+  size_t size() const { return commands_.size(); }
+  bool empty() const { return commands_.empty(); }
+  const Command& command(uint32_t i) const { return commands_[i]; }
+  const std::vector<uint32_t>& bin(uint32_t tile) const { return bins_[tile]; }
+  const Color* pixels(const Command& image) const {
+    return &pixels_[image.firstPixel];
+  }
+
+  // Drop the commands, keeping the bins, for a canvas of WIDTH by
+  // HEIGHT pixels.
+  void reset(uint32_t width, uint32_t height);
+  // Queue COMMAND in the bins of the tiles that RECT touches.
+  void add(const Command& command, const PixelRect& rect);
+  // Copy in the COUNT PIXELS of an image, returning the index of the
+  // first for Command::firstPixel.
+  size_t addPixels(const Color* pixels, size_t count);
+};
+
+// Rasterized painters, for DrawingContext::paintCached.  Entries are
+// keyed by painter identity and pixel size; the cache stops taking new
+// entries once it would exceed MAXBYTES.  In fixed-point mode, copying
+// from the cache is exact for unrotated instances.  Otherwise, and for
+// rotated and flipped copies, pixels whose centers lie exactly on an
+// edge can differ from direct drawing.
+class RenderCache
+{
+public:
+  // A painter rasterized into a frame of FRAMEWIDTH by FRAMEHEIGHT
+  // pixels, whose bottom-left corner is MARGINX pixels from the left and
+  // MARGINY from the bottom of the texture, leaving room for whatever
+  // the painter draws outside its frame.
+  struct Texture
+  {
+    uint32_t frameWidth;
+    uint32_t frameHeight;
+    uint32_t marginX;
+    uint32_t marginY;
+    uint32_t width;
+    uint32_t height;
+    std::vector<Color> pixels;
+    std::vector<uint8_t> coverage;
+
+    Texture(uint32_t frameWidth, uint32_t frameHeight,
+            uint32_t marginX, uint32_t marginY,
+            uint32_t width, uint32_t height)
+      : frameWidth(frameWidth), frameHeight(frameHeight),
+        marginX(marginX), marginY(marginY), width(width), height(height),
+        pixels(size_t(width) * height), coverage(size_t(width) * height) {}
+  };
+  using TexturePtr = std::shared_ptr<const Texture>;
+
+private:
+  struct Key
+  {
+    const Painter *painter;
+    uint32_t width;
+    uint32_t height;
+    uint32_t canvasWidth;
+    uint32_t canvasHeight;
+
+    bool operator<(const Key& other) const;
+  };
+  struct Entry
+  {
+    std::shared_ptr<const Painter> painter;
+    TexturePtr texture;
+  };
+
+  const size_t maxBytes_;
+  size_t bytes_;
+  size_t hits_;
+  size_t misses_;
+  mutable std::mutex lock_;
+  std::map<Key, Entry> entries_;
+
+public:
+  explicit RenderCache(size_t maxBytes = size_t(64) << 20)
+    : maxBytes_(maxBytes), bytes_(0), hits_(0), misses_(0) {}
+
+  size_t maxBytes() const { return maxBytes_; }
+  size_t bytes() const;
+  size_t hits() const;
+  size_t misses() const;
+  void clear();
+
+  // Return the texture for PAINTER at the given size, or null, recording
+  // a hit or a miss.
+  TexturePtr lookup(const std::shared_ptr<const Painter>& painter,
+                    uint32_t width, uint32_t height,
+                    uint32_t canvasWidth, uint32_t canvasHeight);
+  bool wouldFit(uint32_t width, uint32_t height) const;
+  // Insert TEXTURE for PAINTER, unless the cache is full.
+  void insert(const std::shared_ptr<const Painter>& painter,
+              uint32_t canvasWidth, uint32_t canvasHeight,
+              TexturePtr texture);
+};
+
 class Painter
 {
 protected:
@@ -114,21 +816,37 @@ protected:
 public:
   virtual ~Painter() {}
   virtual void paint(DrawingContext &cx, const Frame& frame) const = 0;
+  virtual Bounds bounds() const { return Bounds::unbounded(); }
 };
 
 using PainterPtr = std::shared_ptr<const Painter>;
 
 PainterPtr triangle(const Vector& a, const Vector& b, const Vector& c,
                     const Color& color);
-PainterPtr path(const std::vector<Vector> points, const Color& color,
+PainterPtr path(const std::vector<Vector>& points, const Color& color,
                 double width = 0.01,
                 LineCapStyle lineCapStyle = LineCapStyle::Butt,
-                LineWidthScaling widthScaling = LineWidthScaling::Unscaled);
-PainterPtr image(uint32_t width, uint32_t height, std::vector<Color>&& pixels);
+                LineWidthScaling widthScaling = LineWidthScaling::Unscaled,
+                LineJoinStyle lineJoinStyle = LineJoinStyle::None);
+// Separate lines between each pair of ENDPOINTS, drawn in order.  The
+// same as an over of a two-point path for each pair, in one painter.
+PainterPtr segments(const std::vector<Vector>& endpoints, const Color& color,
+                    double width = 0.01,
+                    LineCapStyle lineCapStyle = LineCapStyle::Butt,
+                    LineWidthScaling widthScaling = LineWidthScaling::Unscaled);
+PainterPtr image(uint32_t width, uint32_t height, std::vector<Color>&& pixels,
+                 ImageSampling sampling = ImageSampling::Nearest);
+// An image read from a binary PPM or PGM file, or null on error.
+PainterPtr image(const char *fname,
+                 ImageSampling sampling = ImageSampling::Nearest);
 
 PainterPtr transform(PainterPtr painter, const Vector& origin,
                      const Vector& corner1, const Vector& corner2);
 PainterPtr over(PainterPtr a, PainterPtr b);
+// P, blended into whatever is below it at opacity ALPHA, from 0 to 1.
+PainterPtr opacity(PainterPtr p, double alpha);
+// B blended over A at opacity ALPHA.
+PainterPtr over(PainterPtr a, PainterPtr b, double alpha);
 
 PainterPtr parallelogram(const Vector& origin, const Vector& edge1,
                          const Vector& edge2, const Color& color);
@@ -148,4 +866,261 @@ PainterPtr white();
 PainterPtr blue();
 PainterPtr red();
 
+// The index of a painter in a PainterArena.
+using PainterId = uint32_t;
+
+// An alternative to PainterPtr for scenes with very many painters.
+// Painters are allocated in a few flat arrays owned by the arena, and
+// refer to their children by index instead of via shared_ptr, so that
+// building a node is an append and the whole scene is freed at once.
+// The methods mirror the free functions above.
+//
+// An arena can be saved to a file and loaded again, in which case its
+// arrays are used in place, straight from the file.
+class PainterArena
+{
+public:
+  enum class Kind : uint8_t {
+    Triangle, Path, Segments, Image, Transform, Over, Opacity,
+    Parallelogram
+  };
+
+  // Twenty bytes, as each of the enums is one byte.
+  struct Node
+  {
+    Kind kind;
+    LineCapStyle lineCapStyle;
+    LineWidthScaling widthScaling;
+    Color color;
+    LineJoinStyle lineJoinStyle;
+    ImageSampling sampling;
+    // Triangle: index of the first of three points.  Parallelogram:
+    // index of the origin, followed by the two edges.  Path, Segments:
+    // index of the first point.  Image: index of the first pixel; with
+    // Mipmap sampling, each smaller level follows.  Transform, Opacity:
+    // the painter to transform or blend.  Over: the painter below.
+    uint32_t first;
+    // Path, Segments: the number of points.  Image: width.  Transform:
+    // index of the frame's six scalars.  Over: the painter on top.
+    // Opacity: index of the alpha scalar.
+    uint32_t second;
+    // Path, Segments: index of the line width scalar.  Image: height.
+    uint32_t third;
+  };
+
+private:
+  // The arrays that painting reads, which are either those below or
+  // those of a loaded file, and their lengths.
+  const Node *nodeData_;
+  const Bounds *boundsData_;
+  const Vector *pointData_;
+  const double *scalarData_;
+  const Color *pixelData_;
+  size_t size_;
+  size_t pointCount_;
+  size_t scalarCount_;
+  size_t pixelCount_;
+  // The arrays that building appends to.  A loaded arena copies the
+  // file's arrays into them before adding anything.
+  std::vector<Node> nodes_;
+  std::vector<Bounds> bounds_;
+  std::vector<Vector> points_;
+  std::vector<double> scalars_;
+  std::vector<Color> pixels_;
+  // The contents of a loaded file, mapped or read into memory.
+  std::shared_ptr<const void> file_;
+
+  PainterId add(const Node& node, const Bounds& bounds);
+  void own();
+  void sync();
+  Frame frame(const Node& node) const;
+
+  friend class ArenaCopier;
+  friend class DamageFinder;
+
+public:
+  PainterArena();
+  PainterArena(const PainterArena&) = delete;
+  PainterArena& operator=(const PainterArena&) = delete;
+
+  size_t size() const { return size_; }
+  void reserve(size_t nodes);
+  const Node& node(PainterId id) const { return nodeData_[id]; }
+  const Bounds& bounds(PainterId id) const { return boundsData_[id]; }
+
+  PainterId triangle(const Vector& a, const Vector& b, const Vector& c,
+                     const Color& color);
+  PainterId path(const std::vector<Vector>& points, const Color& color,
+                 double width = 0.01,
+                 LineCapStyle lineCapStyle = LineCapStyle::Butt,
+                 LineWidthScaling widthScaling = LineWidthScaling::Unscaled,
+                 LineJoinStyle lineJoinStyle = LineJoinStyle::None);
+  PainterId segments(const std::vector<Vector>& endpoints, const Color& color,
+                     double width = 0.01,
+                     LineCapStyle lineCapStyle = LineCapStyle::Butt,
+                     LineWidthScaling widthScaling =
+                       LineWidthScaling::Unscaled);
+  PainterId image(uint32_t width, uint32_t height,
+                  const std::vector<Color>& pixels,
+                  ImageSampling sampling = ImageSampling::Nearest);
+  // These, like paint and the painter function below, abort if given a
+  // painter that isn't in this arena, as ids may come from script.
+  PainterId transform(PainterId painter, const Vector& origin,
+                      const Vector& corner1, const Vector& corner2);
+  PainterId transform(PainterId painter, const Frame& frame);
+  PainterId over(PainterId a, PainterId b);
+  PainterId opacity(PainterId painter, double alpha);
+
+  PainterId parallelogram(const Vector& origin, const Vector& edge1,
+                          const Vector& edge2, const Color& color);
+  PainterId color(const Color& color);
+  PainterId flipHoriz(PainterId painter);
+  PainterId flipVert(PainterId painter);
+  PainterId rotate90(PainterId painter);
+  PainterId rotate180(PainterId painter);
+  PainterId rotate270(PainterId painter);
+  PainterId beside(PainterId a, PainterId b);
+  PainterId below(PainterId a, PainterId b);
+  PainterId beside3(PainterId a, PainterId b, PainterId c);
+  PainterId above3(PainterId a, PainterId b, PainterId c);
+
+  // Paint ID into FRAME, as Painter::paint.
+  void paintNode(DrawingContext& cx, PainterId id, const Frame& frame) const;
+  // Like the paint function: fill with white, then paint ROOT.
+  void paint(DrawingContext& cx, PainterId root) const;
+
+  // Add the graph of P, adding each painter that appears more than once
+  // in it only once.  Returns false if the graph has a painter that
+  // arenas can't represent, such as a subclass of Painter from outside
+  // this file.
+  bool copy(PainterPtr p, PainterId* root);
+
+  // Write the arena and its root painter ROOT to a scene file, or
+  // return false on error.  Scene files are the arena's arrays as they
+  // are in memory, after a header with a version number and the sizes
+  // of the types, so files move between builds that agree on those,
+  // such as native little-endian and WebAssembly builds.
+  bool save(const char *fname, PainterId root) const;
+  // Map a scene file into memory, where possible, and return an arena
+  // that paints from it in place, setting ROOT to its root painter.
+  // Only the nodes are checked, so the rest of the file isn't read
+  // until it is painted.  Returns null on error.
+  static std::shared_ptr<PainterArena> load(const char *fname,
+                                            PainterId* root);
+};
+
+// A Painter for ROOT in ARENA, for use with the PainterPtr functions.
+PainterPtr painter(std::shared_ptr<const PainterArena> arena, PainterId root);
+
+// Save P to a scene file via a PainterArena, or load a scene file as a
+// painter.  Both return false or null on error.
+bool saveScene(const char *fname, PainterPtr p);
+PainterPtr loadScene(const char *fname);
+
+struct SimplifyStats
+{
+  size_t nodesBefore;
+  size_t nodesAfter;
+};
+
+// The number of distinct painters in P's graph.
+size_t countNodes(PainterPtr p);
+
+// Return a painter that paints the same picture as P with fewer nodes,
+// by folding chains of transforms into a single transform, flattening
+// nested overs into n-ary groups, and dropping painters hidden under a
+// later opaque color that fills the same frame.  Shared painters stay
+// shared.  Folded frames are composed ahead of time rather than while
+// painting, so pixels whose centers lie on an edge may round differently.
+// Dropping hidden painters is only exact where the fill covers whole
+// pixels: when antialiasing, they can show through at the edges of a
+// fill whose frame isn't pixel-aligned.
+PainterPtr simplify(PainterPtr p, SimplifyStats* stats = nullptr);
+
+DisplayList compile(PainterPtr p);
+
+// Where paintBands sends the rows of an image as they are finished,
+// from top to bottom.
+class ImageSink
+{
+public:
+  virtual ~ImageSink() {}
+  virtual bool begin(uint32_t width, uint32_t height) = 0;
+  virtual bool writeRows(const Color* pixels, uint32_t rows) = 0;
+  virtual bool finish() = 0;
+};
+
+class PPMSink : public ImageSink
+{
+private:
+  const std::string fname_;
+  FILE *file_;
+  uint32_t width_;
+
+public:
+  explicit PPMSink(const char* fname);
+  ~PPMSink();
+
+  bool begin(uint32_t width, uint32_t height);
+  bool writeRows(const Color* pixels, uint32_t rows);
+  bool finish();
+};
+
+// Writes an uncompressed PNG: the image data is wrapped in stored
+// deflate blocks, so no compression library is needed.
+class PNGSink : public ImageSink
+{
+private:
+  const std::string fname_;
+  FILE *file_;
+  uint32_t width_;
+  uint32_t adler_;
+
+  bool writeChunk(const char* type, const uint8_t* data, size_t size);
+
+public:
+  explicit PNGSink(const char* fname);
+  ~PNGSink();
+
+  bool begin(uint32_t width, uint32_t height);
+  bool writeRows(const Color* pixels, uint32_t rows);
+  bool finish();
+};
+
 void paint(DrawingContext& cx, PainterPtr p);
+// Like paint, but splits the canvas into tiles and paints them on
+// THREADS threads, or one per core if THREADS is zero.  The result is
+// the same as paint.
+void paintParallel(DrawingContext& cx, PainterPtr p, uint32_t threads = 0,
+                   uint32_t tileSize = 256);
+// The parts of CX's clip rectangle that may look different painted with
+// AFTER than with BEFORE, as rectangles of whole 32 by 32 pixel tiles,
+// cut at the clip.  The two painter graphs are walked side by side:
+// painters that are the same object match, as do leaves that are equal
+// in value, and transforms, overs, groups and opacities with the same
+// frame or alpha are matched child by child.  Where two painters don't
+// match, all that either of them could paint is damaged.  Painters from
+// the same arena match by node in the same way.  Everything is damaged
+// if BEFORE is null.
+std::vector<PixelRect> damage(const DrawingContext& cx, PainterPtr before,
+                              PainterPtr after);
+// Update CX, which holds a paint of BEFORE, to a paint of AFTER, by
+// painting AFTER again only within damage(CX, BEFORE, AFTER), with
+// paintParallel on THREADS threads.  The result is the same as paint,
+// but a small edit to a big picture only costs what it touches.
+// Backends have no pixels to keep, so they get all of AFTER.
+void repaint(DrawingContext& cx, PainterPtr before, PainterPtr after,
+             uint32_t threads = 1);
+// The number of threads that paintParallel uses by default.  Builds
+// without threads, such as the single-threaded WebAssembly build,
+// always use one.
+uint32_t parallelism();
+// Paint P onto a WIDTH by HEIGHT canvas BANDHEIGHT rows at a time,
+// sending each band to SINK when it is done, so that only one band is
+// ever in memory.  Bands are painted with paintParallel on THREADS
+// threads.
+bool paintBands(PainterPtr p, uint32_t width, uint32_t height,
+                ImageSink& sink, uint32_t bandHeight = 256,
+                uint32_t threads = 1);
+
+#endif // PICTIE_H
@@ -0,0 +1,22 @@
+#include <stdio.h>
+
+#include "escher.h"
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+  
+  DrawingContext cx(400);
+  cx.setAntialiasing(true);
+
+  paint(cx, escher());
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
@@ -0,0 +1,105 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <memory>
+
+#include "../pictie.h"
+
+static const std::vector<Vector> zigzag =
+  {Vector(.1,.9), Vector(.8,.9), Vector(.1,.2), Vector(.9,.3)};
+static const std::vector<Vector> cross =
+  {Vector(.2,.2), Vector(.8,.8), Vector(.2,.8), Vector(.8,.2)};
+static const std::vector<Color> checks =
+  {Color::red(), Color::white(), Color::white(), Color::blue()};
+
+static bool samePixels(DrawingContext& a, DrawingContext& b) {
+  return !memcmp(a.getPixels().data(), b.getPixels().data(),
+                 size_t(a.width()) * a.height() * sizeof(Color));
+}
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  // The same scene with the free functions and in an arena.  TRI is
+  // used twice.
+  PainterPtr tri = triangle(Vector(.1,.1), Vector(.9,.2), Vector(.4,.8),
+                            Color(100, 100, 200));
+  PainterPtr zig = path(zigzag, Color::black(), 0.02, LineCapStyle::Square,
+                        LineWidthScaling::Scaled, LineJoinStyle::Miter);
+  PainterPtr segs = segments(cross, Color(10, 200, 10), 0.05);
+  PainterPtr img = image(2, 2, std::vector<Color>(checks));
+  PainterPtr p = over(beside(below(tri, img), below(zig, tri)),
+                      opacity(over(color(Color::gray()), segs), 0.5));
+
+  auto arena = std::make_shared<PainterArena>();
+  PainterId atri = arena->triangle(Vector(.1,.1), Vector(.9,.2),
+                                   Vector(.4,.8), Color(100, 100, 200));
+  PainterId azig = arena->path(zigzag, Color::black(), 0.02,
+                               LineCapStyle::Square,
+                               LineWidthScaling::Scaled,
+                               LineJoinStyle::Miter);
+  PainterId asegs = arena->segments(cross, Color(10, 200, 10), 0.05);
+  PainterId aimg = arena->image(2, 2, checks);
+  PainterId root =
+    arena->over(arena->beside(arena->below(atri, aimg),
+                              arena->below(azig, atri)),
+                arena->opacity(arena->over(arena->color(Color::gray()),
+                                           asegs),
+                               0.5));
+
+  // Four leaves; eight nodes for each below, which is three rotations
+  // of a beside of two rotations; three for the beside; three for the
+  // translucent layer; and the over at the root.
+  const size_t nodes = 4 + 8 + 8 + 3 + 3 + 1;
+  if (arena->size() != nodes || countNodes(p) != nodes) {
+    fprintf(stderr, "expected %zu nodes, got %zu in the arena and %zu "
+            "in the graph\n", nodes, arena->size(), countNodes(p));
+    return 1;
+  }
+
+  DrawingContext direct(400);
+  paint(direct, p);
+
+  DrawingContext cx(400);
+  arena->paint(cx, root);
+  if (!samePixels(cx, direct)) {
+    fprintf(stderr, "arena drawing differs from direct drawing\n");
+    return 1;
+  }
+
+  DrawingContext wrapped(400);
+  paint(wrapped, painter(arena, root));
+  if (!samePixels(wrapped, direct)) {
+    fprintf(stderr, "arena painter differs from direct drawing\n");
+    return 1;
+  }
+
+  // Copying the graph adds TRI once.
+  PainterArena copy;
+  PainterId copied;
+  if (!copy.copy(p, &copied)) {
+    fprintf(stderr, "failed to copy into an arena\n");
+    return 1;
+  }
+  if (copy.size() != nodes) {
+    fprintf(stderr, "expected %zu nodes in the copy, got %zu\n", nodes,
+            copy.size());
+    return 1;
+  }
+  DrawingContext copiedCx(400);
+  copy.paint(copiedCx, copied);
+  if (!samePixels(copiedCx, direct)) {
+    fprintf(stderr, "copied arena differs from direct drawing\n");
+    return 1;
+  }
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
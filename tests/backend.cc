@@ -0,0 +1,92 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "escher.h"
+
+// Draws what it is sent into another context, which should give the
+// same pixels as painting into that context directly.
+class Forwarder : public RenderBackend
+{
+private:
+  DrawingContext& cx_;
+
+public:
+  explicit Forwarder(DrawingContext& cx) : cx_(cx) {}
+
+  void fill(const Color& color) { cx_.fill(color); }
+  void drawTriangle(const Vector& a, const Vector& b, const Vector& c,
+                    const Color& color) {
+    cx_.drawTriangle(a, b, c, color);
+  }
+  void drawQuad(const Vector& a, const Vector& b, const Vector& c,
+                const Vector& d, const Color& color) {
+    cx_.drawQuad(a, b, c, d, color);
+  }
+  bool drawPixels(uint32_t pixelWidth, uint32_t pixelHeight,
+                  const Color* pixels, const Vector& origin,
+                  const Vector& edge1, const Vector& edge2,
+                  ImageSampling sampling) {
+    cx_.drawPixels(pixelWidth, pixelHeight, pixels, origin, edge1, edge2,
+                   sampling);
+    return true;
+  }
+};
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  // Escher beside a round-joined zigzag over a small image.
+  PainterPtr zigzag = path({ Vector(0.1, 0.2), Vector(0.3, 0.8),
+                             Vector(0.5, 0.2), Vector(0.7, 0.8),
+                             Vector(0.9, 0.2) },
+                           Color::red(), 0.08, LineCapStyle::Square,
+                           LineWidthScaling::Unscaled, LineJoinStyle::Round);
+  std::vector<Color> pixels;
+  for (int i = 0; i < 16; i++)
+    pixels.push_back((i + i / 4) % 2 ? Color::blue() : Color::gray());
+  PainterPtr checks = image(4, 4, std::move(pixels));
+  PainterPtr p = beside(escher(), over(checks, zigzag));
+
+  DrawingContext cx(400);
+  Forwarder forwarder(cx);
+  DrawingContext forwarding(forwarder, cx.width(), cx.height());
+  paint(forwarding, p);
+
+  DrawingContext direct(400);
+  paint(direct, p);
+  if (memcmp(cx.getPixels().data(), direct.getPixels().data(),
+             400 * 400 * sizeof(Color))) {
+    fprintf(stderr, "forwarded drawing differs from direct drawing\n");
+    return 1;
+  }
+
+  CountingBackend counts;
+  DrawingContext counting(counts, cx.width(), cx.height());
+  paint(counting, p);
+  if (counts.fills != 1 || counts.images != 1 || counts.triangles == 0
+      || counts.quads == 0) {
+    fprintf(stderr, "unexpected counts\n");
+    return 1;
+  }
+
+  SVGBackend svg(cx.width(), cx.height());
+  DrawingContext vector(svg, cx.width(), cx.height());
+  paint(vector, p);
+  std::string fname = std::string(argv[1]) + ".svg";
+  if (!svg.write(fname.c_str())) {
+    return 1;
+  }
+  remove(fname.c_str());
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
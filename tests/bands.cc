@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "escher.h"
+
+static uint32_t getBigEndian32(const uint8_t* in) {
+  return uint32_t(in[0]) << 24 | uint32_t(in[1]) << 16
+    | uint32_t(in[2]) << 8 | in[3];
+}
+
+// Read back the pixels of a PNG written by PNGSink, whose image data is
+// stored deflate blocks, or return false if it isn't as expected.
+static bool readPNG(const char* fname, uint32_t width, uint32_t height,
+                    std::vector<Color>& pixels) {
+  FILE *f = fopen(fname, "rb");
+  if (!f) {
+    perror("failed to open PNG");
+    return false;
+  }
+  std::vector<uint8_t> bytes;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    bytes.insert(bytes.end(), buf, buf + n);
+  fclose(f);
+
+  static const uint8_t signature[8] = { 137, 'P', 'N', 'G', 13, 10, 26, 10 };
+  if (bytes.size() < 8 || memcmp(bytes.data(), signature, 8))
+    return false;
+  std::vector<uint8_t> zlib;
+  bool ended = false;
+  for (size_t pos = 8; pos + 12 <= bytes.size() && !ended; ) {
+    uint32_t size = getBigEndian32(&bytes[pos]);
+    const char* type = reinterpret_cast<const char*>(&bytes[pos + 4]);
+    const uint8_t* data = &bytes[pos + 8];
+    if (pos + 12 + size > bytes.size())
+      return false;
+    if (!memcmp(type, "IHDR", 4)) {
+      if (size != 13 || getBigEndian32(data) != width
+          || getBigEndian32(data + 4) != height || data[8] != 8
+          || data[9] != 2)
+        return false;
+    } else if (!memcmp(type, "IDAT", 4)) {
+      zlib.insert(zlib.end(), data, data + size);
+    } else if (!memcmp(type, "IEND", 4)) {
+      ended = true;
+    }
+    pos += 12 + size;
+  }
+  if (!ended || zlib.size() < 2 + 4 || zlib[0] != 0x78)
+    return false;
+
+  // Undo the stored blocks, then check the checksum and the filters.
+  std::vector<uint8_t> raw;
+  size_t pos = 2;
+  for (bool final = false; !final; ) {
+    if (pos + 5 > zlib.size() || (zlib[pos] & 6) != 0)
+      return false;
+    final = zlib[pos] & 1;
+    uint16_t len = zlib[pos + 1] | zlib[pos + 2] << 8;
+    uint16_t nlen = zlib[pos + 3] | zlib[pos + 4] << 8;
+    if (uint16_t(~len) != nlen || pos + 5 + len > zlib.size())
+      return false;
+    raw.insert(raw.end(), &zlib[pos + 5], &zlib[pos + 5] + len);
+    pos += 5 + len;
+  }
+  uint32_t a = 1, b = 0;
+  for (uint8_t byte : raw) {
+    a = (a + byte) % 65521;
+    b = (b + a) % 65521;
+  }
+  if (pos + 4 != zlib.size() || getBigEndian32(&zlib[pos]) != (b << 16 | a))
+    return false;
+  size_t rowBytes = 1 + size_t(width) * sizeof(Color);
+  if (raw.size() != rowBytes * height)
+    return false;
+  pixels.resize(size_t(width) * height);
+  for (uint32_t y = 0; y < height; y++) {
+    if (raw[y * rowBytes] != 0)
+      return false;
+    memcpy(&pixels[size_t(y) * width], &raw[y * rowBytes + 1], rowBytes - 1);
+  }
+  return true;
+}
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  // Bands of 64 rows, the last of which is short.
+  const uint32_t width = 400, height = 300, bandHeight = 64;
+  DrawingContext direct(width, height);
+  paint(direct, escher());
+
+  // The PPM, read back as an image and painted at its own size.
+  PPMSink ppm(argv[1]);
+  if (!paintBands(escher(), width, height, ppm, bandHeight, 2)) {
+    return 1;
+  }
+  PainterPtr written = image(argv[1]);
+  if (!written) {
+    return 1;
+  }
+  DrawingContext cx(width, height);
+  paint(cx, written);
+  if (memcmp(cx.getPixels().data(), direct.getPixels().data(),
+             size_t(width) * height * sizeof(Color))) {
+    fprintf(stderr, "PPM written in bands differs from direct drawing\n");
+    return 1;
+  }
+
+  // The PNG, with more than one stored block per band.
+  std::string png = std::string(argv[1]) + ".png";
+  PNGSink pngSink(png.c_str());
+  if (!paintBands(escher(), width, height, pngSink, bandHeight, 2)) {
+    return 1;
+  }
+  std::vector<Color> pixels;
+  bool read = readPNG(png.c_str(), width, height, pixels);
+  remove(png.c_str());
+  if (!read) {
+    fprintf(stderr, "PNG written in bands is malformed\n");
+    return 1;
+  }
+  if (memcmp(pixels.data(), direct.getPixels().data(),
+             size_t(width) * height * sizeof(Color))) {
+    fprintf(stderr, "PNG written in bands differs from direct drawing\n");
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
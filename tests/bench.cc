@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "scenes.h"
+
+static bool samePixels(DrawingContext& a, DrawingContext& b) {
+  return !memcmp(a.getPixels().data(), b.getPixels().data(),
+                 size_t(a.width()) * a.height() * sizeof(Color));
+}
+
+// Paint SCENE in each of the ways that the benchmarks time it, and
+// check each against a plain paint.
+static bool check(const Scene& scene, uint32_t resolution) {
+  PainterPtr p = scene.make();
+  DrawingContext direct(resolution);
+  paint(direct, p);
+
+  auto fail = [&](const char* mode) {
+    fprintf(stderr, "%s at %upx: %s differs from direct drawing\n",
+            scene.name, resolution, mode);
+    return false;
+  };
+
+  DrawingContext parallel(resolution);
+  paintParallel(parallel, p, 0);
+  if (!samePixels(parallel, direct))
+    return fail("paintParallel");
+
+  DrawingContext binned(resolution);
+  CommandBins bins(64);
+  binned.setBins(&bins);
+  binned.fill(Color::white());
+  p->paint(binned, Frame(Vector(0,0), Vector(1,0), Vector(0,1)));
+  binned.flush(parallelism());
+  if (!samePixels(binned, direct))
+    return fail("binned drawing");
+
+  DrawingContext frontToBack(resolution);
+  compile(p).paintFrontToBack(frontToBack);
+  if (!samePixels(frontToBack, direct))
+    return fail("front to back");
+
+  // Moving a small square from one place to another.
+  auto square = [&](double x) {
+    return over(p, transform(red(), Vector(x, 0.45), Vector(x + 0.05, 0.45),
+                             Vector(x, 0.5)));
+  };
+  DrawingContext repainted(resolution);
+  paint(repainted, square(0.3));
+  repaint(repainted, square(0.3), square(0.6), 0);
+  DrawingContext moved(resolution);
+  paint(moved, square(0.6));
+  if (!samePixels(repainted, moved))
+    return fail("repaint");
+
+  // Fixed point tests no pixels, so the benchmarks leave out the count.
+  DrawingContext fixed(resolution);
+  fixed.setFixedPoint(true);
+  DrawingContext fixedParallel(resolution);
+  fixedParallel.setFixedPoint(true);
+  paint(fixed, p);
+  paintParallel(fixedParallel, p, 0);
+  if (!samePixels(fixedParallel, fixed))
+    return fail("fixed-point paintParallel");
+#ifndef PICTIE_NO_STATS
+  if (fixed.stats().pixelsTested || !fixed.stats().pixelsCovered) {
+    fprintf(stderr, "%s at %upx: fixed point tested pixels\n", scene.name,
+            resolution);
+    return false;
+  }
+#endif
+
+  DrawingContext antialiased(resolution);
+  antialiased.setAntialiasing(true);
+  DrawingContext antialiasedParallel(resolution);
+  antialiasedParallel.setAntialiasing(true);
+  paint(antialiased, p);
+  paintParallel(antialiasedParallel, p, 0);
+  if (!samePixels(antialiasedParallel, antialiased))
+    return fail("antialiased paintParallel");
+
+  return true;
+}
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  for (const Scene& scene : scenes)
+    for (uint32_t resolution : { 200, 401 })
+      if (!check(scene, resolution))
+        return 1;
+
+  // All of the scenes, in a grid.
+  PainterPtr s[9];
+  for (size_t i = 0; i < 9; i++)
+    s[i] = i < sizeof(scenes) / sizeof(scenes[0]) ? scenes[i].make() : white();
+  DrawingContext cx(400);
+  paintParallel(cx, above3(beside3(s[0], s[1], s[2]),
+                           beside3(s[3], s[4], s[5]),
+                           beside3(s[6], s[7], s[8])));
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
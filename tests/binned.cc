@@ -0,0 +1,48 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "escher.h"
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+  
+  // Drawn a tile at a time, on two threads; the same as drawing
+  // straight away.
+  DrawingContext cx(400);
+  CommandBins bins(64);
+  cx.setBins(&bins);
+
+  cx.fill(Color::white());
+  escher()->paint(cx, Frame(Vector(0,0), Vector(1,0), Vector(0,1)));
+  cx.flush(2);
+
+  DrawingContext direct(400);
+  paint(direct, escher());
+  if (memcmp(cx.getPixels().data(), direct.getPixels().data(),
+             400 * 400 * sizeof(Color))) {
+    fprintf(stderr, "binned drawing differs from direct drawing\n");
+    return 1;
+  }
+
+  // Reading the pixels flushes what is still queued.
+  DrawingContext queued(400);
+  CommandBins queuedBins(64);
+  queued.setBins(&queuedBins);
+  queued.fill(Color::white());
+  escher()->paint(queued, Frame(Vector(0,0), Vector(1,0), Vector(0,1)));
+  if (memcmp(queued.getPixels().data(), direct.getPixels().data(),
+             400 * 400 * sizeof(Color))) {
+    fprintf(stderr, "getPixels didn't flush the bins\n");
+    return 1;
+  }
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "zorro.h"
+
+static bool samePixels(DrawingContext& a, DrawingContext& b) {
+  return !memcmp(a.getPixels().data(), b.getPixels().data(),
+                 size_t(a.width()) * a.height() * sizeof(Color));
+}
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  // One tile, shared four times in a grid of pixel-aligned frames.
+  PainterPtr tile = over(triangle(Vector(.1,.1), Vector(.9,.2), Vector(.4,.8),
+                                  Color(100, 100, 200)),
+                         zorro());
+  PainterPtr p = beside(below(tile, tile), below(tile, tile));
+
+  // In fixed-point mode, the tile is painted once and copied three
+  // times, exactly.
+  DrawingContext direct(400);
+  direct.setFixedPoint(true);
+  paint(direct, p);
+
+  RenderCache cache;
+  DrawingContext cx(400);
+  cx.setFixedPoint(true);
+  cx.setRenderCache(&cache);
+  paint(cx, p);
+  if (!samePixels(cx, direct)) {
+    fprintf(stderr, "cached drawing differs from direct drawing\n");
+    return 1;
+  }
+  if (cache.misses() != 1 || cache.hits() != 3) {
+    fprintf(stderr, "expected 1 miss and 3 hits, got %zu and %zu\n",
+            cache.misses(), cache.hits());
+    return 1;
+  }
+
+  // Painting again only copies.
+  size_t bytes = cache.bytes();
+  paint(cx, p);
+  if (!samePixels(cx, direct)) {
+    fprintf(stderr, "second cached drawing differs from direct drawing\n");
+    return 1;
+  }
+  if (cache.misses() != 1 || cache.hits() != 7 || cache.bytes() != bytes) {
+    fprintf(stderr, "second paint added to the cache\n");
+    return 1;
+  }
+
+  // A cache too small for the tile paints it directly every time.
+  RenderCache small(1024);
+  DrawingContext uncached(400);
+  uncached.setFixedPoint(true);
+  uncached.setRenderCache(&small);
+  paint(uncached, p);
+  if (!samePixels(uncached, direct) || small.hits() || small.bytes()) {
+    fprintf(stderr, "full cache was used\n");
+    return 1;
+  }
+
+  // Antialiased drawing doesn't use the cache.
+  RenderCache unused;
+  DrawingContext antialiased(400);
+  antialiased.setAntialiasing(true);
+  antialiased.setRenderCache(&unused);
+  paint(antialiased, p);
+  if (unused.hits() || unused.misses()) {
+    fprintf(stderr, "cache used when antialiasing\n");
+    return 1;
+  }
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
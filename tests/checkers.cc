@@ -1,6 +1,6 @@
 #include <stdio.h>
 
-#include "../pictie.h"
+#include "checkers.h"
 
 int main (int argc, char* argv[]) {
   if (argc != 2) {
@@ -9,10 +9,7 @@ int main (int argc, char* argv[]) {
   }
   
   DrawingContext cx(200);
-  auto bg = below(black(), gray());
-  auto row = beside3(bg, flipVert(bg), bg);
-  auto rows = above3(row, flipVert(row), row);
-  paint(cx, rows);
+  paint(cx, checkers());
 
   if (!cx.writePPM(argv[1])) {
     return 1;
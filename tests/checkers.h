@@ -0,0 +1,15 @@
+// A three by three checkerboard of black-over-gray squares, every
+// other one flipped, shared by the checkers test and the benchmarks.
+
+#ifndef PICTIE_TESTS_CHECKERS_H
+#define PICTIE_TESTS_CHECKERS_H
+
+#include "../pictie.h"
+
+static PainterPtr checkers() {
+  auto bg = below(black(), gray());
+  auto row = beside3(bg, flipVert(bg), bg);
+  return above3(row, flipVert(row), row);
+}
+
+#endif // PICTIE_TESTS_CHECKERS_H
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "escher.h"
+
+static bool samePixels(const DrawingContext& a, const DrawingContext& b,
+                       const PixelRect& rect) {
+  for (uint32_t y = rect.y0; y < rect.y1; y++)
+    if (memcmp(a.pixelRow(y) + rect.x0, b.pixelRow(y) + rect.x0,
+               (rect.x1 - rect.x0) * sizeof(Color)))
+      return false;
+  return true;
+}
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  DrawingContext direct(400);
+  paint(direct, escher());
+
+  // Painting into a view culls the painters that miss it, but leaves
+  // what is in the view as it would be otherwise, and what is outside
+  // alone.
+  DrawingContext cx(400);
+  cx.fill(Color(200, 100, 100));
+  PixelRect tile(100, 150, 230, 260);
+  DrawingContext view(cx, tile);
+  paint(view, escher());
+  if (!samePixels(cx, direct, tile)) {
+    fprintf(stderr, "culled drawing differs from direct drawing\n");
+    return 1;
+  }
+  DrawingContext untouched(400);
+  untouched.fill(Color(200, 100, 100));
+  if (!samePixels(cx, untouched, PixelRect(0, 0, 400, tile.y0))
+      || !samePixels(cx, untouched, PixelRect(0, tile.y1, 400, 400))
+      || !samePixels(cx, untouched, PixelRect(0, tile.y0, tile.x0, tile.y1))
+      || !samePixels(cx, untouched,
+                     PixelRect(tile.x1, tile.y0, 400, tile.y1))) {
+    fprintf(stderr, "pixels outside the view were drawn\n");
+    return 1;
+  }
+#ifndef PICTIE_NO_STATS
+  if (!view.stats().culled
+      || view.stats().painters >= direct.stats().painters) {
+    fprintf(stderr, "nothing was culled\n");
+    return 1;
+  }
+#endif
+
+#ifndef PICTIE_NO_STATS
+  // Paths and segments off the canvas are culled without being
+  // stroked, even when they aren't in a transform.
+  std::vector<Vector> offscreen = {Vector(1.5,1.5), Vector(2,1.6),
+                                   Vector(1.7,2)};
+  DrawingContext strokes(400);
+  strokes.resetStats();
+  Frame unit(Vector(0,0), Vector(1,0), Vector(0,1));
+  path(offscreen, Color::black())->paint(strokes, unit);
+  segments({offscreen[0], offscreen[1]}, Color::black())->paint(strokes, unit);
+  if (strokes.stats().culled != 2 || strokes.stats().quads != 0
+      || strokes.stats().triangles != 0) {
+    fprintf(stderr, "offscreen strokes weren't culled\n");
+    return 1;
+  }
+#endif
+
+  // A transform of a triangle four pixels wide is skipped with a cull
+  // threshold of five pixels, and drawn with one of three.
+  PainterPtr small = transform(triangle(Vector(.5,.5), Vector(.51,.5),
+                                        Vector(.5,.51), Color::black()),
+                               Vector(0,0), Vector(1,0), Vector(0,1));
+  DrawingContext drawn(400);
+  paint(drawn, small);
+  DrawingContext unculled(400);
+  unculled.setCullThreshold(3);
+  paint(unculled, small);
+  DrawingContext culled(400);
+  culled.setCullThreshold(5);
+  paint(culled, small);
+  DrawingContext blank(400);
+  blank.fill(Color::white());
+  PixelRect all(0, 0, 400, 400);
+  if (samePixels(drawn, blank, all)
+      || !samePixels(unculled, drawn, all)
+      || !samePixels(culled, blank, all)) {
+    fprintf(stderr, "cull threshold not respected\n");
+    return 1;
+  }
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
@@ -0,0 +1,38 @@
+#include <stdio.h>
+
+#include "../pictie.h"
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+  
+  PainterPtr checkers = image("test-checkers.ppm");
+  PainterPtr smooth = image("test-checkers.ppm", ImageSampling::Bilinear);
+  PainterPtr small = image("test-checkers.ppm", ImageSampling::Mipmap);
+  if (!checkers || !smooth || !small) {
+    return 1;
+  }
+
+  DrawingContext cx(200);
+  paint(cx, over(over(blue(), transform(checkers,
+                                        Vector(0.5,0.1),
+                                        Vector(0.9,0.5),
+                                        Vector(0.1,0.5))),
+                 over(transform(smooth,
+                                Vector(0.05,0.75),
+                                Vector(0.25,0.7),
+                                Vector(0.1,0.95)),
+                      transform(small,
+                                Vector(0.75,0.75),
+                                Vector(0.95,0.75),
+                                Vector(0.75,0.95)))));
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
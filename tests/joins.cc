@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "../pictie.h"
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+  
+  // A zigzag with one join style per row, from None at the top to
+  // Round at the bottom.
+  PainterPtr rows = nullptr;
+  LineJoinStyle styles[] = { LineJoinStyle::None, LineJoinStyle::Miter,
+                             LineJoinStyle::Bevel, LineJoinStyle::Round };
+  for (int i = 0; i < 4; i++) {
+    double y = 0.8 - i * 0.22;
+    auto zigzag = path({ Vector(0.1, y), Vector(0.3, y + 0.12),
+                         Vector(0.45, y), Vector(0.55, y + 0.12),
+                         Vector(0.6, y), Vector(0.9, y + 0.1) },
+                       Color::black(), 0.04, LineCapStyle::Butt,
+                       LineWidthScaling::Unscaled, styles[i]);
+    rows = rows ? over(rows, zigzag) : zigzag;
+  }
+
+  DrawingContext cx(400);
+  paint(cx, rows);
+
+  // A miter whose corner is off the left edge but whose tip isn't.
+  // Culling it by its bounds, as paths and transforms do, mustn't lose
+  // the tip.
+  PainterPtr tip = path({ Vector(-0.48, 0.38), Vector(-0.1, 0.5),
+                          Vector(-0.48, 0.62) },
+                        Color::black(), 0.1, LineCapStyle::Butt,
+                        LineWidthScaling::Unscaled, LineJoinStyle::Miter);
+  DrawingContext bare(400), culled(400), blank(400);
+  paint(bare, tip);
+  paint(culled, transform(tip, Vector(0,0), Vector(1,0), Vector(0,1)));
+  blank.fill(Color::white());
+  std::vector<Color> drawn = bare.getPixels();
+  if (!memcmp(drawn.data(), blank.getPixels().data(),
+              400 * 400 * sizeof(Color))
+      || memcmp(drawn.data(), culled.getPixels().data(),
+                400 * 400 * sizeof(Color))) {
+    fprintf(stderr, "culling lost a miter tip\n");
+    return 1;
+  }
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
@@ -0,0 +1,39 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "escher.h"
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  // Escher over a stack of opaque layers that hide one another, drawn
+  // front to back; the same as drawing it back to front.
+  PainterPtr p = escher();
+  for (int i = 0; i < 8; i++) {
+    auto c = color(Color(40 + i * 20, 100, 200 - i * 10));
+    auto w = white();
+    p = over(above3(beside3(c, w, c), beside3(w, c, w), beside3(c, w, c)),
+             p);
+  }
+
+  DrawingContext cx(400);
+  compile(p).paintFrontToBack(cx);
+
+  DrawingContext direct(400);
+  paint(direct, p);
+  if (memcmp(cx.getPixels().data(), direct.getPixels().data(),
+             400 * 400 * sizeof(Color))) {
+    fprintf(stderr, "front to back differs from back to front\n");
+    return 1;
+  }
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
@@ -0,0 +1,42 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "escher.h"
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+  
+  DrawingContext cx(400);
+  PainterPtr red = transform(::red(), Vector(0.1,0.1), Vector(0.6,0.1),
+                             Vector(0.1,0.6));
+  PainterPtr pair = transform(beside(blue(), color(Color(10,200,10))),
+                              Vector(0.4,0.4), Vector(0.9,0.4),
+                              Vector(0.4,0.9));
+
+  PainterPtr p = over(over(escher(), red, 0.5), opacity(pair, 0.7), 0.5);
+  paint(cx, p);
+
+  // Compiled, the translucent groups are kept, and blend the same.
+  DisplayList list = compile(p);
+  DrawingContext replayed(400), frontToBack(400);
+  list.paint(replayed);
+  list.paintFrontToBack(frontToBack);
+  std::vector<Color> pixels = cx.getPixels();
+  if (memcmp(replayed.getPixels().data(), pixels.data(),
+             pixels.size() * sizeof(Color))
+      || memcmp(frontToBack.getPixels().data(), pixels.data(),
+                pixels.size() * sizeof(Color))) {
+    fprintf(stderr, "display list differs from paint\n");
+    return 1;
+  }
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "escher.h"
+
+// Paint the scene with paintParallel into a WIDTH by HEIGHT canvas, and
+// compare with paint.
+static bool check(uint32_t width, uint32_t height, uint32_t threads,
+                  uint32_t tileSize) {
+  DrawingContext direct(width, height);
+  paint(direct, escher());
+
+  DrawingContext cx(width, height);
+  paintParallel(cx, escher(), threads, tileSize);
+  if (memcmp(cx.getPixels().data(), direct.getPixels().data(),
+             size_t(width) * height * sizeof(Color))) {
+    fprintf(stderr, "%ux%u on %u threads in %u pixel tiles differs from "
+            "direct drawing\n", width, height, threads, tileSize);
+    return false;
+  }
+  return true;
+}
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  // Tiles that divide the canvas evenly and tiles that don't, with more
+  // threads than tiles and more tiles than threads.
+  if (!check(400, 400, 1, 256)
+      || !check(400, 400, 4, 64)
+      || !check(400, 400, 3, 100)
+      || !check(400, 400, 16, 256)
+      || !check(301, 257, 4, 32)
+      || !check(301, 257, 2, 1000)) {
+    return 1;
+  }
+
+  DrawingContext cx(400);
+  paintParallel(cx, escher(), 4, 64);
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
@@ -1,6 +1,6 @@
 #include <stdio.h>
 
-#include "../pictie.h"
+#include "quartet.h"
 
 int main (int argc, char* argv[]) {
   if (argc != 2) {
@@ -9,17 +9,7 @@ int main (int argc, char* argv[]) {
   }
   
   DrawingContext cx(800);
-
-  auto above = [&](auto p1, auto p2) {
-    return below(p2, p1);
-  };
-  auto quartet = [&](auto p1, auto p2, auto p3, auto p4) {
-    return above(beside(p1, p2), beside(p3, p4));
-  };
-  paint(cx, quartet(color(Color(200,100,100)),
-                    color(Color(100,200,100)),
-                    color(Color(100,100,200)),
-                    color(Color(100,100,100))));
+  paint(cx, quartet());
 
   if (!cx.writePPM(argv[1])) {
     return 1;
@@ -0,0 +1,22 @@
+// Four colors in a two by two grid, shared by the quartet test and the
+// benchmarks.
+
+#ifndef PICTIE_TESTS_QUARTET_H
+#define PICTIE_TESTS_QUARTET_H
+
+#include "../pictie.h"
+
+static PainterPtr quartet() {
+  auto above = [&](auto p1, auto p2) {
+    return below(p2, p1);
+  };
+  auto quartet = [&](auto p1, auto p2, auto p3, auto p4) {
+    return above(beside(p1, p2), beside(p3, p4));
+  };
+  return quartet(color(Color(200,100,100)),
+                 color(Color(100,200,100)),
+                 color(Color(100,100,200)),
+                 color(Color(100,100,100)));
+}
+
+#endif // PICTIE_TESTS_QUARTET_H
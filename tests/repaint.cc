@@ -0,0 +1,56 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "escher.h"
+
+// Escher in the corner of a grid of colors, with the middle color and
+// the color of a path across the grid as given.  Each call builds the
+// whole scene afresh.
+static PainterPtr scene(const Color& middle, const Color& stroke) {
+  PainterPtr grid =
+    above3(beside3(escher(), gray(), color(Color(50,200,50))),
+           beside3(blue(), color(middle), red()),
+           beside3(white(), black(), color(Color(200,150,150))));
+  PainterPtr line = path({ Vector(0.7, 0.1), Vector(0.9, 0.3),
+                           Vector(0.7, 0.5) },
+                         stroke, 0.02, LineCapStyle::Butt,
+                         LineWidthScaling::Unscaled, LineJoinStyle::Miter);
+  return over(grid, line);
+}
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  PainterPtr before = scene(Color::black(), Color::blue());
+  PainterPtr after = scene(Color(200,200,50), Color::white());
+
+  DrawingContext cx(400);
+  paint(cx, before);
+  // Only the middle of the grid and the path should need painting.
+  size_t damaged = 0;
+  for (const PixelRect& r : damage(cx, before, after))
+    damaged += size_t(r.x1 - r.x0) * (r.y1 - r.y0);
+  if (damaged == 0 || damaged > 400 * 400 / 2) {
+    fprintf(stderr, "unexpected damage: %zu pixels\n", damaged);
+    return 1;
+  }
+  repaint(cx, before, after);
+
+  DrawingContext fresh(400);
+  paint(fresh, after);
+  if (memcmp(cx.getPixels().data(), fresh.getPixels().data(),
+             400 * 400 * sizeof(Color))) {
+    fprintf(stderr, "repaint differs from paint\n");
+    return 1;
+  }
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
@@ -0,0 +1,57 @@
+#include <stdio.h>
+
+#include "escher.h"
+
+// Check that CX's RGBA bytes are its pixels with opaque alpha.
+static bool check(const char* name, DrawingContext& cx) {
+  std::vector<Color> pixels = cx.getPixels();
+  const std::vector<uint8_t>& rgba = cx.getRGBA();
+  const PixelRect& clip = cx.clip();
+  size_t count = size_t(clip.x1 - clip.x0) * (clip.y1 - clip.y0);
+  if (pixels.size() != count || rgba.size() != count * 4) {
+    fprintf(stderr, "%s: expected %zu pixels, got %zu and %zu bytes\n",
+            name, count, pixels.size(), rgba.size());
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (rgba[i * 4] != pixels[i].r || rgba[i * 4 + 1] != pixels[i].g
+        || rgba[i * 4 + 2] != pixels[i].b || rgba[i * 4 + 3] != 255) {
+      fprintf(stderr, "%s: pixel %zu differs\n", name, i);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  DrawingContext cx(400);
+  paint(cx, escher());
+  if (!check("canvas", cx)) {
+    return 1;
+  }
+
+  // A view, whose rows are a part of its parent's.
+  DrawingContext view(cx, PixelRect(100, 150, 230, 260));
+  if (!check("view", view)) {
+    return 1;
+  }
+
+  // A band of rows, painted on its own.
+  DrawingContext band(400, 400, 64, 100);
+  paint(band, escher());
+  if (!check("band", band)) {
+    return 1;
+  }
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
@@ -1,6 +1,6 @@
 #include <stdio.h>
 
-#include "../pictie.h"
+#include "rotated.h"
 
 int main (int argc, char* argv[]) {
   if (argc != 2) {
@@ -9,11 +9,7 @@ int main (int argc, char* argv[]) {
   }
   
   DrawingContext cx(200);
-  PainterPtr rotated = transform(color(Color(100, 100, 200)),
-                                 Vector(0.5,0.1),
-                                 Vector(0.9,0.5),
-                                 Vector(0.1,0.5));
-  paint(cx, rotated);
+  paint(cx, rotated());
 
   if (!cx.writePPM(argv[1])) {
     return 1;
@@ -0,0 +1,16 @@
+// A square of color turned 45 degrees, shared by the rotated test and
+// the benchmarks.
+
+#ifndef PICTIE_TESTS_ROTATED_H
+#define PICTIE_TESTS_ROTATED_H
+
+#include "../pictie.h"
+
+static PainterPtr rotated() {
+  return transform(color(Color(100, 100, 200)),
+                   Vector(0.5,0.1),
+                   Vector(0.9,0.5),
+                   Vector(0.1,0.5));
+}
+
+#endif // PICTIE_TESTS_ROTATED_H
@@ -0,0 +1,96 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "escher.h"
+
+static bool readFile(const char* fname, std::vector<uint8_t>& bytes) {
+  FILE *f = fopen(fname, "rb");
+  if (!f)
+    return false;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    bytes.insert(bytes.end(), buf, buf + n);
+  return fclose(f) == 0;
+}
+
+static bool writeFile(const char* fname, const std::vector<uint8_t>& bytes) {
+  FILE *f = fopen(fname, "wb");
+  if (!f)
+    return false;
+  bool ok = fwrite(bytes.data(), 1, bytes.size(), f) == bytes.size();
+  return fclose(f) == 0 && ok;
+}
+
+// Save a mipmapped image as a scene, then give its node a size whose
+// pixel count, with the smaller levels and the index of its first
+// pixel, wraps around to zero.  Loading it must fail.
+static bool rejectsOverflowingImage(const std::string& fname) {
+  std::vector<Color> pixels(4, Color::red());
+  if (!saveScene(fname.c_str(),
+                 image(2, 2, std::move(pixels), ImageSampling::Mipmap)))
+    return false;
+  std::vector<uint8_t> bytes;
+  if (!readFile(fname.c_str(), bytes))
+    return false;
+  // The offset of the nodes is the first of the header's offsets, 80
+  // bytes in, and the image is the only node.
+  uint64_t offset;
+  memcpy(&offset, &bytes[80], sizeof(offset));
+  PainterArena::Node node;
+  memcpy(&node, &bytes[offset], sizeof(node));
+  node.first = 3221225471u;
+  node.second = 3221225472u;
+  node.third = 4294967295u;
+  memcpy(&bytes[offset], &node, sizeof(node));
+  if (!writeFile(fname.c_str(), bytes))
+    return false;
+  PainterPtr loaded = loadScene(fname.c_str());
+  remove(fname.c_str());
+  if (loaded) {
+    fprintf(stderr, "loaded a scene whose image overflows\n");
+    return false;
+  }
+  return true;
+}
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  // The opacity test, saved to a scene file and painted from it.
+  PainterPtr red = transform(::red(), Vector(0.1,0.1), Vector(0.6,0.1),
+                             Vector(0.1,0.6));
+  PainterPtr pair = transform(beside(blue(), color(Color(10,200,10))),
+                              Vector(0.4,0.4), Vector(0.9,0.4),
+                              Vector(0.4,0.9));
+  std::string scene = std::string(argv[1]) + ".scene";
+  if (!saveScene(scene.c_str(),
+                 over(over(escher(), red, 0.5), opacity(pair, 0.7), 0.5))) {
+    return 1;
+  }
+  PainterPtr loaded = loadScene(scene.c_str());
+  remove(scene.c_str());
+  if (!loaded) {
+    return 1;
+  }
+
+  if (!rejectsOverflowingImage(scene)) {
+    return 1;
+  }
+
+  DrawingContext cx(400);
+  paint(cx, loaded);
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
@@ -0,0 +1,31 @@
+// The scenes that the benchmarks time, by name, shared with the test
+// that checks them in each of the benchmarks' modes.
+
+#ifndef PICTIE_TESTS_SCENES_H
+#define PICTIE_TESTS_SCENES_H
+
+#include "checkers.h"
+#include "escher.h"
+#include "nonet.h"
+#include "quartet.h"
+#include "rotated.h"
+#include "square.h"
+#include "zorro.h"
+
+struct Scene
+{
+  const char *name;
+  PainterPtr (*make)();
+};
+
+static const Scene scenes[] = {
+  { "checkers", checkers },
+  { "escher", escher },
+  { "nonet", nonet },
+  { "quartet", quartet },
+  { "rotated", rotated },
+  { "square", square },
+  { "zorro", zorro },
+};
+
+#endif // PICTIE_TESTS_SCENES_H
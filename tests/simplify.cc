@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "zorro.h"
+
+static bool samePixels(DrawingContext& a, DrawingContext& b) {
+  return !memcmp(a.getPixels().data(), b.getPixels().data(),
+                 size_t(a.width()) * a.height() * sizeof(Color));
+}
+
+// Simplify P, expecting BEFORE nodes to become AFTER, and check that it
+// paints the same, with and without antialiasing.  The frames of the
+// scenes here are all dyadic, so composing them ahead of time rounds no
+// differently, and pixel-aligned at this size, so fills that hide
+// painters cover whole pixels.
+static PainterPtr check(const char* name, PainterPtr p, size_t before,
+                        size_t after) {
+  SimplifyStats stats;
+  PainterPtr simplified = simplify(p, &stats);
+  if (stats.nodesBefore != before || stats.nodesAfter != after
+      || countNodes(p) != before || countNodes(simplified) != after) {
+    fprintf(stderr, "%s: expected %zu nodes to become %zu, got %zu and %zu\n",
+            name, before, after, stats.nodesBefore, stats.nodesAfter);
+    return nullptr;
+  }
+
+  for (bool antialias : { false, true }) {
+    DrawingContext direct(400);
+    direct.setAntialiasing(antialias);
+    paint(direct, p);
+    DrawingContext cx(400);
+    cx.setAntialiasing(antialias);
+    paint(cx, simplified);
+    if (!samePixels(cx, direct)) {
+      fprintf(stderr, "%s: simplified drawing differs%s\n", name,
+              antialias ? " when antialiasing" : "");
+      return nullptr;
+    }
+  }
+  return simplified;
+}
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  PainterPtr tri = triangle(Vector(.1,.1), Vector(.9,.2), Vector(.4,.8),
+                            Color(100, 100, 200));
+  PainterPtr segs = segments({Vector(.2,.2), Vector(.8,.8),
+                              Vector(.2,.8), Vector(.8,.2)},
+                             Color(10, 200, 10), 0.05);
+
+  // Two flips fold into one transform.
+  if (!check("flips", flipHoriz(flipHoriz(zorro())), 3, 2))
+    return 1;
+
+  // Nested overs become one group of their three leaves.
+  if (!check("overs", over(over(tri, zorro()), segs), 5, 4))
+    return 1;
+
+  // The triangle is hidden under the gray that fills the frame after
+  // it, leaving a group of the gray and the segments.
+  if (!check("hidden", over(tri, over(gray(), segs)), 5, 3))
+    return 1;
+
+  // Likewise for a triangle along the edges of the right half, which
+  // is pixel-aligned, so that antialiasing doesn't let it show through.
+  PainterPtr edges = triangle(Vector(0,0), Vector(1,0), Vector(0,1),
+                              Color::red());
+  if (!check("hidden at the edges", beside(segs, over(edges, gray())), 7, 5))
+    return 1;
+
+  // A shared painter stays shared: both halves transform the same
+  // zigzag, once the flips are folded into them.
+  PainterPtr flipped = flipHoriz(flipHoriz(zorro()));
+  if (!check("shared", beside(flipped, flipped), 6, 4))
+    return 1;
+
+  // All together: the beside's over and the transform of its right half
+  // stay, around the group of gray and segments; the left half is a
+  // transform of the zigzag.
+  PainterPtr simplified =
+    check("scene", beside(flipHoriz(flipHoriz(zorro())),
+                          over(tri, over(gray(), segs))),
+          11, 7);
+  if (!simplified)
+    return 1;
+
+  DrawingContext cx(400);
+  paint(cx, simplified);
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
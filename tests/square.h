@@ -0,0 +1,16 @@
+// A square of color inset from the edges, shared by the square test
+// and the benchmarks.
+
+#ifndef PICTIE_TESTS_SQUARE_H
+#define PICTIE_TESTS_SQUARE_H
+
+#include "../pictie.h"
+
+static PainterPtr square() {
+  return transform(color(Color(100, 100, 200)),
+                   Vector(0.1,0.1),
+                   Vector(0.9,0.1),
+                   Vector(0.1,0.9));
+}
+
+#endif // PICTIE_TESTS_SQUARE_H
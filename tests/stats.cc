@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "square.h"
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  // A transform of a color, filling 320 by 320 pixels of 400 by 400.
+  DrawingContext cx(400);
+  RenderTrace trace;
+  cx.resetStats();
+  cx.setTrace(&trace);
+  paint(cx, square());
+  cx.setTrace(nullptr);
+
+  const RenderStats& s = cx.stats();
+#ifdef PICTIE_NO_STATS
+  // Nothing is counted or traced.
+  const uint64_t painters = 0, transforms = 0, quads = 0, inside = 0;
+  const uint64_t written = 0;
+  const size_t events = 0;
+#else
+  const uint64_t painters = 2, transforms = 1, quads = 1;
+  const uint64_t inside = 320 * 320;
+  // The fill, then the square.
+  const uint64_t written = 400 * 400 + inside;
+  const size_t events = 2;
+#endif
+  if (s.painters != painters || s.transforms != transforms
+      || s.culled != 0 || s.triangles != 0 || s.quads != quads
+      || s.images != 0 || s.occluded != 0
+      || s.boundingBoxPixels != inside || s.pixelsCovered != inside
+      || s.pixelsTested > inside || (s.pixelsTested == 0) != (inside == 0)
+      || s.pixelsWritten != written) {
+    fprintf(stderr, "unexpected stats: %llu painters, %llu transforms, "
+            "%llu quads, %llu bounding box pixels, %llu tested, "
+            "%llu covered, %llu written\n",
+            (unsigned long long)s.painters,
+            (unsigned long long)s.transforms,
+            (unsigned long long)s.quads,
+            (unsigned long long)s.boundingBoxPixels,
+            (unsigned long long)s.pixelsTested,
+            (unsigned long long)s.pixelsCovered,
+            (unsigned long long)s.pixelsWritten);
+    return 1;
+  }
+  if (s.boundingBoxEfficiency() != 1.0) {
+    fprintf(stderr, "an axis-aligned square wasted bounding box pixels\n");
+    return 1;
+  }
+
+  // The color finishes first, within the transform that painted it.
+  if (trace.size() != events) {
+    fprintf(stderr, "expected %zu trace events, got %zu\n", events,
+            trace.size());
+    return 1;
+  }
+  if (events) {
+    const RenderTrace::Event& inner = trace.events()[0];
+    const RenderTrace::Event& outer = trace.events()[1];
+    if (strcmp(inner.name, "parallelogram") || inner.depth != 1
+        || strcmp(outer.name, "transform") || outer.depth != 0
+        || inner.start < outer.start
+        || inner.start + inner.duration > outer.start + outer.duration) {
+      fprintf(stderr, "trace events don't nest\n");
+      return 1;
+    }
+    std::string json = trace.toJSON();
+    if (json.find("\"traceEvents\"") == std::string::npos
+        || json.find("\"name\": \"transform\"") == std::string::npos
+        || json.find("\"depth\": 1") == std::string::npos) {
+      fprintf(stderr, "unexpected trace JSON:\n%s", json.c_str());
+      return 1;
+    }
+  }
+
+  // Painted in four tiles on two threads, the square is four quads
+  // that cover as much as the one did, and each tile's events are
+  // added in.
+  DrawingContext tiled(400);
+  RenderTrace tiledTrace;
+  tiled.resetStats();
+  tiled.setTrace(&tiledTrace);
+  paintParallel(tiled, square(), 2, 200);
+  const RenderStats& t = tiled.stats();
+  if (t.quads != quads * 4 || t.transforms != transforms * 4
+      || t.pixelsCovered != inside || t.pixelsWritten != written
+      || tiledTrace.size() != events * 4) {
+    fprintf(stderr, "unexpected stats from paintParallel: %llu quads, "
+            "%llu covered, %zu events\n", (unsigned long long)t.quads,
+            (unsigned long long)t.pixelsCovered, tiledTrace.size());
+    return 1;
+  }
+  for (const RenderTrace::Event& e : tiledTrace.events()) {
+    if (e.thread >= 2) {
+      fprintf(stderr, "trace event from thread %u of 2\n", e.thread);
+      return 1;
+    }
+  }
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
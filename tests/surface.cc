@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+
+#include "escher.h"
+
+// Escher, then a blue layer at half opacity, composited onto a surface
+// of PIXEL.  Flattened over white, the first should give Escher's own
+// pixels, and the second their average with blue, to within TOLERANCE.
+template<typename Pixel>
+static bool check(const char* name, DrawingContext& below,
+                  DrawingContext& above, int tolerance,
+                  std::vector<Color>* flattened) {
+  Surface<Pixel> surface(below.width(), below.height());
+  std::vector<Color> expected(below.getPixels());
+  for (const Color& c : surface.flatten(Color::white())) {
+    if (c.r != 255 || c.g != 255 || c.b != 255) {
+      fprintf(stderr, "%s: new surface isn't transparent\n", name);
+      return false;
+    }
+  }
+
+  if (!surface.composite(below))
+    return false;
+  if (memcmp(surface.flatten(Color::white()).data(), expected.data(),
+             expected.size() * sizeof(Color))) {
+    fprintf(stderr, "%s: opaque layer differs\n", name);
+    return false;
+  }
+
+  if (!surface.composite(above, 0.5))
+    return false;
+  std::vector<Color> top(above.getPixels());
+  *flattened = surface.flatten(Color::white());
+  for (size_t i = 0; i < expected.size(); i++) {
+    const Color& e = expected[i];
+    const Color& t = top[i];
+    const Color& c = (*flattened)[i];
+    if (abs(c.r - (e.r + t.r + 1) / 2) > tolerance
+        || abs(c.g - (e.g + t.g + 1) / 2) > tolerance
+        || abs(c.b - (e.b + t.b + 1) / 2) > tolerance) {
+      fprintf(stderr, "%s: translucent layer differs at pixel %zu\n", name,
+              i);
+      return false;
+    }
+  }
+  return true;
+}
+
+int main (int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s OUT\n", argv[0]);
+    return 1;
+  }
+
+  DrawingContext below(400), above(400);
+  paint(below, escher());
+  paint(above, blue());
+
+  // Half of 8-bit values round the same way in each format, but half
+  // floats can't hold every midpoint exactly.
+  std::vector<Color> rgba8, rgba16f, rgbaf32;
+  if (!check<RGBA8>("RGBA8", below, above, 0, &rgba8)
+      || !check<RGBA16F>("RGBA16F", below, above, 1, &rgba16f)
+      || !check<RGBAF32>("RGBAF32", below, above, 0, &rgbaf32))
+    return 1;
+
+  Surface<RGBAF32> surface(400, 400);
+  surface.composite(below);
+  std::string fname = std::string(argv[1]) + ".pfm";
+  if (!surface.writePFM(fname.c_str())) {
+    return 1;
+  }
+  remove(fname.c_str());
+
+  // Show the 8-bit result.
+  DrawingContext cx(400);
+  paint(cx, image(400, 400, std::move(rgba8)));
+
+  if (!cx.writePPM(argv[1])) {
+    return 1;
+  }
+
+  fprintf(stdout, "wrote output to %s\n", argv[1]);
+  return 0;
+}
@@ -0,0 +1,87 @@
+// Exercise pictie-worker.js under node's worker_threads.  Run via
+// "make check-worker" in the root directory, which builds
+// pictie.module.js first.
+
+'use strict';
+
+const { Worker } = require('worker_threads');
+const path = require('path');
+
+let worker = new Worker(path.join(__dirname, '..', 'pictie-worker.js'));
+let waiters = [];
+let messages = [];
+worker.on('message', msg => {
+  messages.push(msg);
+  waiters = waiters.filter(w => !w());
+});
+worker.on('error', e => { console.error(e); process.exit(1); });
+
+// Resolve with the first message with the given ID and type.
+let expect = (id, ...types) => new Promise(resolve => {
+  let check = () => {
+    let i = messages.findIndex(m => m.id === id && types.includes(m.type));
+    if (i < 0)
+      return false;
+    resolve(messages.splice(i, 1)[0]);
+    return true;
+  };
+  if (!check())
+    waiters.push(check);
+});
+
+let bands = id => messages.filter(m => m.id === id && m.type === 'band');
+
+let assert = (cond, what) => {
+  if (!cond) {
+    console.error(`FAIL: ${what}`);
+    process.exit(1);
+  }
+  console.log(`ok: ${what}`);
+};
+
+let main = async () => {
+  await expect(undefined, 'ready');
+
+  // A painter, rendered in bands.
+  worker.postMessage({type: 'eval', id: 1, expr: 'beside(black(), white())',
+                      width: 64, height: 64, bandHeight: 16});
+  let result = await expect(1, 'result');
+  assert(result.painter && result.def === '$0', 'painter result');
+  await expect(1, 'done');
+  let got = bands(1);
+  assert(got.length === 4, 'four bands');
+  assert(got.every((b, i) => b.y === i * 16 && b.rows === 16),
+         'bands in order');
+  let rgba = new Uint8Array(got[2].rgba);
+  assert(rgba.length === 64 * 16 * 4, 'band size');
+  assert(rgba[0] === 0 && rgba[3] === 255, 'left half black');
+  assert(rgba[63 * 4] === 255, 'right half white');
+
+  // Definitions persist, and non-painters are described.
+  worker.postMessage({type: 'eval', id: 2, expr: '$0 instanceof Painter'});
+  result = await expect(2, 'result');
+  assert(result.repr === 'true', 'definitions persist');
+
+  worker.postMessage({type: 'eval', id: 3, expr: 'nosuchfunction()'});
+  result = await expect(3, 'result');
+  assert(result.error, 'errors are reported');
+
+  // A cancelled render stops early, and the next one still completes.
+  worker.postMessage({type: 'eval', id: 4,
+                      expr: 'above3($0, rotate90($0), flipHoriz($0))',
+                      width: 512, height: 512, bandHeight: 1});
+  await expect(4, 'band');
+  worker.postMessage({type: 'cancel'});
+  worker.postMessage({type: 'eval', id: 5, expr: 'red()',
+                      width: 8, height: 8, bandHeight: 8});
+  await expect(4, 'cancelled');
+  assert(bands(4).length < 512, 'cancelled render stops early');
+  await expect(5, 'done');
+  rgba = new Uint8Array(bands(5)[0].rgba);
+  assert(rgba[0] === 255 && rgba[1] === 0, 'render after cancel');
+
+  await worker.terminate();
+  console.log('Success.');
+};
+
+main();
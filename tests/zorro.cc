@@ -1,6 +1,6 @@
 #include <stdio.h>
 
-#include "../pictie.h"
+#include "zorro.h"
 
 int main (int argc, char* argv[]) {
   if (argc != 2) {
@@ -9,10 +9,7 @@ int main (int argc, char* argv[]) {
   }
   
   DrawingContext cx(500);
-
-  paint(cx,
-        path({Vector(.1,.9), Vector(.8,.9), Vector(.1,.2), Vector(.9,.3)},
-             Color::black(), 0.01, LineCapStyle::Butt));
+  paint(cx, zorro());
 
   if (!cx.writePPM(argv[1])) {
     return 1;
@@ -0,0 +1,14 @@
+// A zigzag Z drawn as a single path, shared by the zorro test and the
+// benchmarks.
+
+#ifndef PICTIE_TESTS_ZORRO_H
+#define PICTIE_TESTS_ZORRO_H
+
+#include "../pictie.h"
+
+static PainterPtr zorro() {
+  return path({Vector(.1,.9), Vector(.8,.9), Vector(.1,.2), Vector(.9,.3)},
+              Color::black(), 0.01, LineCapStyle::Butt);
+}
+
+#endif // PICTIE_TESTS_ZORRO_H